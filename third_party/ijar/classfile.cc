@@ -97,8 +97,9 @@ enum TARGET_TYPE {
 struct Constant;
 
 // TODO(adonovan) these globals are unfortunate
-static std::vector<Constant*>        const_pool_in; // input constant pool
-static std::vector<Constant*>        const_pool_out; // output constant_pool
+// They are per thread, so that several threads can run StripClass at once.
+static thread_local std::vector<Constant*> const_pool_in; // input constant pool
+static thread_local std::vector<Constant*> const_pool_out; // output constant_pool
 
 // Returns the Constant object, given an index into the input constant pool.
 // Note: constant(0) == NULL; this invariant is exploited by the
@@ -41,13 +41,17 @@ const size_t CLASS_EXTENSION_LENGTH = strlen(CLASS_EXTENSION);
 // ZipExtractorProcessor that select only .class file and use
 // StripClass to generate an interface class, storing as a new file
 // in the specified ZipBuilder.
-class JarStripperProcessor : public ZipExtractorProcessor {
+class JarStripperProcessor : public ParallelZipExtractorProcessor {
  public:
   JarStripperProcessor() {}
   virtual ~JarStripperProcessor() {}
 
   virtual void Process(const char* filename, const u4 attr,
                        const u1* data, const size_t size);
+  virtual size_t Transform(const char* filename, const u4 attr,
+                           const u1* data, const size_t size, u1* out);
+  virtual void Store(const char* filename, const u4 attr,
+                     const u1* data, const size_t size);
   virtual bool Accept(const char* filename, const u4 attr);
 
  private:
@@ -73,19 +77,34 @@ bool JarStripperProcessor::Accept(const char* filename, const u4 attr) {
 
 void JarStripperProcessor::Process(const char* filename, const u4 attr,
                                    const u1* data, const size_t size) {
+  // Strip straight into the output file.
+  u1 *q = builder->NewFile(filename, 0);
+  size_t out_length = Transform(filename, attr, data, size, q);
+  builder->FinishFile(out_length);
+}
+
+size_t JarStripperProcessor::Transform(const char* filename, const u4 attr,
+                                       const u1* data, const size_t size,
+                                       u1* out) {
   if (verbose) {
     fprintf(stderr, "INFO: StripClass: %s\n", filename);
   }
-  u1 *q = builder->NewFile(filename, 0);
-  u1 *classdata_out = q;
+  u1 *q = out;
   StripClass(q, data, size);  // actually process it
-  size_t out_length = q - classdata_out;
-  builder->FinishFile(out_length);
+  return q - out;
+}
+
+void JarStripperProcessor::Store(const char* filename, const u4 attr,
+                                 const u1* data, const size_t size) {
+  u1 *q = builder->NewFile(filename, 0);
+  memcpy(q, data, size);
+  builder->FinishFile(size);
 }
 
 // Opens "file_in" (a .jar file) for reading, and writes an interface
-// .jar to "file_out".
-void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
+// .jar to "file_out", stripping classes on "num_threads" threads.
+void OpenFilesAndProcessJar(const char *file_out, const char *file_in,
+                            int num_threads) {
   JarStripperProcessor processor;
   std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(file_in, &processor));
   if (in.get() == NULL) {
@@ -103,7 +122,10 @@ void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
   processor.SetZipBuilder(out.get());
 
   // Process all files in the zip
-  if (in->ProcessAll() < 0) {
+  int result = num_threads > 1
+      ? in->ProcessAllParallel(&processor, num_threads)
+      : in->ProcessAll();
+  if (result < 0) {
     fprintf(stderr, "%s\n", in->GetError());
     abort();
   }
@@ -133,18 +155,26 @@ void OpenFilesAndProcessJar(const char *file_out, const char *file_in) {
 // main method
 //
 static void usage() {
-  fprintf(stderr, "Usage: ijar [-v] x.jar [x_interface.jar>]\n");
+  fprintf(stderr, "Usage: ijar [-v] [-j threads] x.jar [x_interface.jar>]\n");
   fprintf(stderr, "Creates an interface jar from the specified jar file.\n");
+  fprintf(stderr, "With -j, inflates and strips classes on that many "
+          "threads.\n");
   exit(1);
 }
 
 int main(int argc, char **argv) {
   const char *filename_in = NULL;
   const char *filename_out = NULL;
+  int num_threads = 1;
 
   for (int ii = 1; ii < argc; ++ii) {
     if (strcmp(argv[ii], "-v") == 0) {
       devtools_ijar::verbose = true;
+    } else if (strcmp(argv[ii], "-j") == 0 && ii + 1 < argc) {
+      num_threads = atoi(argv[++ii]);
+      if (num_threads < 1) {
+        usage();
+      }
     } else if (filename_in == NULL) {
       filename_in = argv[ii];
     } else if (filename_out == NULL) {
@@ -177,6 +207,7 @@ int main(int argc, char **argv) {
     fprintf(stderr, "INFO: writing to '%s'.\n", filename_out);
   }
 
-  devtools_ijar::OpenFilesAndProcessJar(filename_out, filename_in);
+  devtools_ijar::OpenFilesAndProcessJar(filename_out, filename_in,
+                                        num_threads);
   return 0;
 }
@@ -0,0 +1,446 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// ijar_benchmark.cc -- times ijar on a large synthetic jar.
+//
+// Writes a deflated jar of generated classes, each with public and private
+// fields and methods whose Code attributes ijar drops, plus some resources,
+// then strips it with ProcessAll() and with ProcessAllParallel() at
+// increasing thread counts and checks that every run produces the same
+// interface jar.
+//
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "third_party/ijar/zip.h"
+#include <zlib.h>
+
+namespace devtools_ijar {
+
+bool verbose = false;
+
+void StripClass(u1 *&classdata_out, const u1 *classdata_in, size_t in_length);
+
+// Does what ijar's JarStripperProcessor does.
+class BenchmarkProcessor : public ParallelZipExtractorProcessor {
+ public:
+  BenchmarkProcessor() : builder_(NULL) {}
+
+  virtual bool Accept(const char* filename, const u4 attr) {
+    size_t len = strlen(filename);
+    return len > 6 && strcmp(filename + len - 6, ".class") == 0;
+  }
+
+  virtual size_t Transform(const char* filename, const u4 attr,
+                           const u1* data, const size_t size, u1* out) {
+    u1 *q = out;
+    StripClass(q, data, size);
+    return q - out;
+  }
+
+  virtual void Store(const char* filename, const u4 attr,
+                     const u1* data, const size_t size) {
+    u1 *q = builder_->NewFile(filename, 0);
+    memcpy(q, data, size);
+    builder_->FinishFile(size);
+  }
+
+  void SetZipBuilder(ZipBuilder* builder) {
+    builder_ = builder;
+  }
+
+ private:
+  ZipBuilder* builder_;
+};
+
+// Builds class files in the JVM class file format.
+class ClassWriter {
+ public:
+  // Add a CONSTANT_Utf8 and return its index.
+  u2 Utf8(const std::string& s) {
+    put_u1(1);
+    put_u2(s.size());
+    data_.insert(data_.end(), s.begin(), s.end());
+    return ++pool_count_;
+  }
+
+  // Add a CONSTANT_Class and return its index.
+  u2 Class(const std::string& name) {
+    u2 name_index = Utf8(name);
+    put_u1(7);
+    put_u2(name_index);
+    return ++pool_count_;
+  }
+
+  // Make a class named "name" with "members" fields and methods, half of
+  // them private, whose methods have "code_length" bytes of code.
+  std::vector<u1> Build(const std::string& name, int members,
+                        int code_length, unsigned* seed) {
+    data_.clear();
+    pool_count_ = 0;
+    u2 this_class = Class(name);
+    u2 super_class = Class("java/lang/Object");
+    u2 code = Utf8("Code");
+    u2 source_file = Utf8("SourceFile");
+    u2 source = Utf8(name + ".java");
+    u2 int_type = Utf8("I");
+    u2 void_method = Utf8("()V");
+    std::vector<u2> names;
+    for (int ii = 0; ii < members; ++ii) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "member%d", ii);
+      names.push_back(Utf8(buf));
+    }
+    std::vector<u1> pool;
+    pool.swap(data_);
+
+    put_u2(0x21);  // ACC_PUBLIC | ACC_SUPER
+    put_u2(this_class);
+    put_u2(super_class);
+    put_u2(0);  // interfaces_count
+    put_u2(members);  // fields_count
+    for (int ii = 0; ii < members; ++ii) {
+      put_u2(ii % 2 ? 0x0002 : 0x0001);  // ACC_PRIVATE or ACC_PUBLIC
+      put_u2(names[ii]);
+      put_u2(int_type);
+      put_u2(0);  // attributes_count
+    }
+    put_u2(members);  // methods_count
+    for (int ii = 0; ii < members; ++ii) {
+      put_u2(ii % 2 ? 0x0002 : 0x0001);
+      put_u2(names[ii]);
+      put_u2(void_method);
+      put_u2(1);  // attributes_count
+      put_u2(code);
+      put_u4(code_length);
+      // Bytecode-like bytes: a small alphabet, so it compresses like code.
+      for (int jj = 0; jj < code_length; ++jj) {
+        put_u1(0x10 + rand_r(seed) % 48);
+      }
+    }
+    put_u2(1);  // attributes_count
+    put_u2(source_file);
+    put_u4(2);
+    put_u2(source);
+    std::vector<u1> body;
+    body.swap(data_);
+
+    put_u4(0xCAFEBABE);
+    put_u2(0);  // minor_version
+    put_u2(52);  // major_version
+    put_u2(pool_count_ + 1);
+    data_.insert(data_.end(), pool.begin(), pool.end());
+    data_.insert(data_.end(), body.begin(), body.end());
+    return data_;
+  }
+
+ private:
+  void put_u1(u1 x) { data_.push_back(x); }
+  void put_u2(u2 x) { put_u1(x >> 8); put_u1(x & 0xff); }
+  void put_u4(u4 x) { put_u2(x >> 16); put_u2(x & 0xffff); }
+
+  std::vector<u1> data_;
+  u2 pool_count_;
+};
+
+// Writes a ZIP file with deflated entries, which ZipBuilder can't do.
+class DeflatedZipWriter {
+ public:
+  explicit DeflatedZipWriter(FILE* file) : file_(file), offset_(0) {}
+
+  bool Add(const std::string& filename, const std::vector<u1>& data) {
+    uLongf compressed_length = compressBound(data.size());
+    std::vector<u1> compressed(compressed_length);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = data.size();
+    stream.next_out = compressed.data();
+    stream.avail_out = compressed.size();
+    int ret = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    if (ret != Z_STREAM_END) {
+      return false;
+    }
+
+    Entry entry;
+    entry.filename = filename;
+    entry.crc = crc32(0, data.data(), data.size());
+    entry.compressed_size = compressed.size();
+    entry.uncompressed_size = data.size();
+    entry.offset = offset_;
+    entries_.push_back(entry);
+
+    std::vector<u1> header(30);
+    u1 *p = header.data();
+    put_u4le(p, 0x04034b50);  // local file header signature
+    put_u2le(p, 20);  // version to extract
+    put_u2le(p, 0);  // general purpose bit flag
+    put_u2le(p, 8);  // compression method: deflated
+    put_u2le(p, 0);  // last_mod_file_time
+    put_u2le(p, 0);  // last_mod_file_date
+    put_u4le(p, entry.crc);
+    put_u4le(p, entry.compressed_size);
+    put_u4le(p, entry.uncompressed_size);
+    put_u2le(p, filename.size());
+    put_u2le(p, 0);  // extra_field_length
+    return Write(header.data(), header.size()) &&
+        Write(filename.data(), filename.size()) &&
+        Write(compressed.data(), compressed.size());
+  }
+
+  bool Finish() {
+    u4 central_dir_offset = offset_;
+    for (size_t ii = 0; ii < entries_.size(); ++ii) {
+      const Entry& entry = entries_[ii];
+      std::vector<u1> header(46);
+      u1 *p = header.data();
+      put_u4le(p, 0x02014b50);  // central file header signature
+      put_u2le(p, 20);  // version made by
+      put_u2le(p, 20);  // version to extract
+      put_u2le(p, 0);  // general purpose bit flag
+      put_u2le(p, 8);  // compression method: deflated
+      put_u2le(p, 0);  // last_mod_file_time
+      put_u2le(p, 0);  // last_mod_file_date
+      put_u4le(p, entry.crc);
+      put_u4le(p, entry.compressed_size);
+      put_u4le(p, entry.uncompressed_size);
+      put_u2le(p, entry.filename.size());
+      put_u2le(p, 0);  // extra field length
+      put_u2le(p, 0);  // file comment length
+      put_u2le(p, 0);  // disk number start
+      put_u2le(p, 0);  // internal file attributes
+      put_u4le(p, mode_to_zipattr(0100644));  // external file attributes
+      put_u4le(p, entry.offset);
+      if (!Write(header.data(), header.size()) ||
+          !Write(entry.filename.data(), entry.filename.size())) {
+        return false;
+      }
+    }
+    u4 central_dir_size = offset_ - central_dir_offset;
+
+    std::vector<u1> end(22);
+    u1 *p = end.data();
+    put_u4le(p, 0x06054b50);  // end of central dir signature
+    put_u2le(p, 0);  // number of this disk
+    put_u2le(p, 0);  // disk with the start of the central directory
+    put_u2le(p, entries_.size());
+    put_u2le(p, entries_.size());
+    put_u4le(p, central_dir_size);
+    put_u4le(p, central_dir_offset);
+    put_u2le(p, 0);  // comment length
+    return Write(end.data(), end.size());
+  }
+
+ private:
+  struct Entry {
+    std::string filename;
+    u4 crc;
+    u4 compressed_size;
+    u4 uncompressed_size;
+    u4 offset;
+  };
+
+  bool Write(const void* data, size_t size) {
+    offset_ += size;
+    return fwrite(data, 1, size, file_) == size;
+  }
+
+  FILE *file_;
+  u4 offset_;
+  std::vector<Entry> entries_;
+};
+
+bool WriteSyntheticJar(const char* path, int classes, int members,
+                       int code_length) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+  DeflatedZipWriter writer(file);
+  ClassWriter class_writer;
+  unsigned seed = 1;
+  bool ok = true;
+  for (int ii = 0; ok && ii < classes; ++ii) {
+    char name[64];
+    snprintf(name, sizeof(name), "com/example/pkg%d/Class%d", ii / 100, ii);
+    ok = writer.Add(std::string(name) + ".class",
+                    class_writer.Build(name, members, code_length, &seed));
+    // Every so often, a resource for ijar to skip.
+    if (ok && ii % 50 == 0) {
+      std::vector<u1> resource(4096, 'x');
+      ok = writer.Add(std::string(name) + ".properties", resource);
+    }
+  }
+  ok = ok && writer.Finish();
+  return fclose(file) == 0 && ok;
+}
+
+// Strips "jar_in" into "jar_out" on "num_threads" threads, or with
+// ProcessAll() if it is zero. Returns the time taken in milliseconds, or
+// -1 on error.
+double StripJar(const char* jar_out, const char* jar_in, int num_threads) {
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  BenchmarkProcessor processor;
+  std::unique_ptr<ZipExtractor> in(ZipExtractor::Create(jar_in, &processor));
+  if (in.get() == NULL) {
+    fprintf(stderr, "Unable to open Zip file %s: %s\n", jar_in,
+            strerror(errno));
+    return -1;
+  }
+  std::unique_ptr<ZipBuilder> out(
+      ZipBuilder::Create(jar_out, in->CalculateOutputLength()));
+  if (out.get() == NULL) {
+    fprintf(stderr, "Unable to open output file %s: %s\n", jar_out,
+            strerror(errno));
+    return -1;
+  }
+  processor.SetZipBuilder(out.get());
+  int result = num_threads == 0
+      ? in->ProcessAll()
+      : in->ProcessAllParallel(&processor, num_threads);
+  if (result < 0) {
+    fprintf(stderr, "%s\n", in->GetError());
+    return -1;
+  }
+  if (out->Finish() < 0) {
+    fprintf(stderr, "%s\n", out->GetError());
+    return -1;
+  }
+
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - start.tv_sec) * 1000.0 +
+      (end.tv_usec - start.tv_usec) / 1000.0;
+}
+
+bool ReadWholeFile(const char* path, std::string* contents) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  char buf[64 * 1024];
+  size_t len;
+  contents->clear();
+  while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+    contents->append(buf, len);
+  }
+  fclose(file);
+  return true;
+}
+
+}  // namespace devtools_ijar
+
+static void usage() {
+  fprintf(stderr, "Usage: ijar_benchmark [-n classes] [-m members] "
+          "[-c code_bytes] [-j max_threads] [-d dir]\n");
+  fprintf(stderr, "Times ijar on a synthetic jar of that many classes, "
+          "written to dir.\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int classes = 50000;
+  int members = 8;
+  int code_length = 120;
+  int max_threads = std::thread::hardware_concurrency();
+  const char *dir = "/tmp";
+  for (int ii = 1; ii < argc; ++ii) {
+    if (ii + 1 == argc) {
+      usage();
+    }
+    if (strcmp(argv[ii], "-n") == 0) {
+      classes = atoi(argv[++ii]);
+    } else if (strcmp(argv[ii], "-m") == 0) {
+      members = atoi(argv[++ii]);
+    } else if (strcmp(argv[ii], "-c") == 0) {
+      code_length = atoi(argv[++ii]);
+    } else if (strcmp(argv[ii], "-j") == 0) {
+      max_threads = atoi(argv[++ii]);
+    } else if (strcmp(argv[ii], "-d") == 0) {
+      dir = argv[++ii];
+    } else {
+      usage();
+    }
+  }
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+
+  char jar_in[PATH_MAX], jar_out[PATH_MAX], jar_expected[PATH_MAX];
+  snprintf(jar_in, PATH_MAX, "%s/ijar_benchmark_%d.jar", dir, getpid());
+  snprintf(jar_out, PATH_MAX, "%s/ijar_benchmark_%d-out.jar", dir, getpid());
+  snprintf(jar_expected, PATH_MAX, "%s/ijar_benchmark_%d-interface.jar", dir,
+           getpid());
+
+  if (!devtools_ijar::WriteSyntheticJar(jar_in, classes, members,
+                                        code_length)) {
+    fprintf(stderr, "Unable to write %s: %s\n", jar_in, strerror(errno));
+    return 1;
+  }
+  std::string expected, actual;
+  devtools_ijar::ReadWholeFile(jar_in, &actual);
+  printf("%d classes, %.1fMB jar\n", classes, actual.size() / 1048576.0);
+
+  // The first run warms up the page cache.
+  int status = 0;
+  for (int pass = 0; pass < 2 && status == 0; ++pass) {
+    double ms = devtools_ijar::StripJar(jar_expected, jar_in, 0);
+    if (ms < 0) {
+      status = 1;
+    } else if (pass == 1) {
+      printf("ProcessAll:                %8.1fms\n", ms);
+    }
+  }
+  devtools_ijar::ReadWholeFile(jar_expected, &expected);
+
+  for (int threads = 1; status == 0 && threads <= max_threads;
+       threads = threads < max_threads ? std::min(threads * 2, max_threads)
+                                       : threads + 1) {
+    double ms = devtools_ijar::StripJar(jar_out, jar_in, threads);
+    if (ms < 0) {
+      status = 1;
+      break;
+    }
+    printf("ProcessAllParallel(j=%-3d): %8.1fms\n", threads, ms);
+    if (!devtools_ijar::ReadWholeFile(jar_out, &actual) ||
+        actual != expected) {
+      fprintf(stderr, "output differs from ProcessAll()\n");
+      status = 1;
+    }
+  }
+
+  unlink(jar_in);
+  unlink(jar_out);
+  unlink(jar_expected);
+  return status;
+}
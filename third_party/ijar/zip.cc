@@ -35,7 +35,12 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <limits.h>
+#include <algorithm>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "third_party/ijar/zip.h"
@@ -73,6 +78,61 @@ static bool ProcessCentralDirEntry(const u1 *&p,
                                    u4 *attr,
                                    u4 *offset);
 
+//
+// Inflates raw deflate streams into a buffer, reusing the buffer and the
+// zlib stream from one file to the next. Each thread needs its own.
+//
+class Inflater {
+ public:
+  Inflater();
+  ~Inflater();
+
+  const char* GetError() {
+    return errmsg;
+  }
+
+  // Inflate the deflate stream starting at "data", which has at most
+  // "length" bytes, into the buffer. "size_hint" is the expected
+  // uncompressed size. Sets "compressed_size" and "uncompressed_size" to the
+  // actual sizes and returns the uncompressed data, which is owned by the
+  // Inflater and valid until the next call.
+  // On failure, returns NULL and GetError() will return an error message.
+  u1* Inflate(const u1* data, size_t length, size_t size_hint,
+              size_t* compressed_size, size_t* uncompressed_size);
+
+ private:
+  // Buffer size is initially INITIAL_BUFFER_SIZE, or the expected size of
+  // the file if that is larger. It doubles in size every time it is found
+  // too small, until it reaches MAX_BUFFER_SIZE. If that is not enough, we
+  // bail out. We only decompress class files, so they should be smaller than
+  // 64K anyway, but we give a little leeway.
+  // MAX_BUFFER_SIZE must be bigger than the size of the biggest file in the
+  // ZIP. It is set to 128M here so we can uncompress the Bazel server with
+  // this library.
+  static const size_t INITIAL_BUFFER_SIZE = 256 * 1024;  // 256K
+  static const size_t MAX_BUFFER_SIZE = 128 * 1024 * 1024;
+
+  // Resize the buffer to "size" bytes, at most MAX_BUFFER_SIZE.
+  void Resize(size_t size);
+
+  z_stream stream_;
+  bool stream_initialized_;
+
+  // C-style memory management is used so that we can call realloc.
+  u1 *buffer_;
+  size_t buffer_allocated_;
+
+  char errmsg[256];
+
+  u1* error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, ap);
+    va_end(ap);
+    return NULL;
+  }
+};
+
 //
 // A class representing a ZipFile for reading. Its public API is exposed
 // using the ZipExtractor abstract class.
@@ -91,6 +151,8 @@ class InputZipFile : public ZipExtractor {
   }
 
   virtual bool ProcessNext();
+  virtual int ProcessAllParallel(ParallelZipExtractorProcessor *processor,
+                                 int num_threads);
   virtual void Reset();
   virtual size_t GetSize() {
     return in_length_;
@@ -117,17 +179,12 @@ class InputZipFile : public ZipExtractor {
 
   const u1* central_dir_current_;  // central dir input cursor
 
-  // Buffer size is initially INITIAL_BUFFER_SIZE. It doubles in size every
-  // time it is found too small, until it reaches MAX_BUFFER_SIZE. If that is
-  // not enough, we bail out. We only decompress class files, so they should
-  // be smaller than 64K anyway, but we give a little leeway.
-  // MAX_BUFFER_SIZE must be bigger than the size of the biggest file in the
-  // ZIP. It is set to 128M here so we can uncompress the Bazel server with
-  // this library.
-  static const size_t INITIAL_BUFFER_SIZE = 256 * 1024;  // 256K
-  static const size_t MAX_BUFFER_SIZE = 128 * 1024 * 1024;
   static const size_t MAX_MAPPED_REGION = 32 * 1024 * 1024;
 
+  // Files that ProcessAllParallel() lets threads get ahead of the one being
+  // stored, per thread. This bounds the memory held by results.
+  static const size_t PARALLEL_WINDOW_PER_THREAD = 64;
+
   // These metadata fields are the fields of the ZIP header of the file being
   // processed.
   u2 extract_version_;
@@ -140,12 +197,9 @@ class InputZipFile : public ZipExtractor {
   const u1 *file_name_;
   const u1 *extra_field_;
 
-  // Administration of memory reserved for decompressed data. We use the same
-  // buffer for each file to avoid some malloc()/free() calls and free the
-  // memory only in the dtor. C-style memory management is used so that we
-  // can call realloc.
-  u1 *uncompressed_data_;
-  size_t uncompressed_data_allocated_;
+  // Decompresses files for ProcessNext(). We use the same buffer and zlib
+  // stream for each file to avoid some malloc()/free() calls.
+  Inflater inflater_;
 
   // Copy of the last filename entry - Null-terminated.
   char filename[PATH_MAX];
@@ -180,6 +234,11 @@ class InputZipFile : public ZipExtractor {
   // Read one entry from input zip file
   int ProcessLocalFileEntry(size_t compressed_size, size_t uncompressed_size);
 
+  // Read the local file header at the input cursor into the metadata fields
+  // above and advance the cursor to the file data. "compressed_size" and
+  // "uncompressed_size" come from the central directory.
+  int ReadLocalFileHeader(size_t compressed_size, size_t uncompressed_size);
+
   // Uncompress a file from the archive using zlib. The pointer returned
   // is owned by InputZipFile, so it must not be freed. Advances the input
   // cursor to the first byte after the compressed data.
@@ -291,6 +350,105 @@ class OutputZipFile : public ZipBuilder {
 
 
 
+//
+// Implementation of Inflater
+//
+Inflater::Inflater()
+  : stream_initialized_(false), buffer_allocated_(INITIAL_BUFFER_SIZE) {
+  buffer_ = reinterpret_cast<u1*>(malloc(buffer_allocated_));
+  errmsg[0] = 0;
+}
+
+Inflater::~Inflater() {
+  if (stream_initialized_) {
+    inflateEnd(&stream_);
+  }
+  free(buffer_);
+}
+
+void Inflater::Resize(size_t size) {
+  // A copy, since std::min() would bind a reference to the constant, which
+  // has no definition.
+  size_t max_size = MAX_BUFFER_SIZE;
+  buffer_allocated_ = std::min(size, max_size);
+  buffer_ = reinterpret_cast<u1*>(realloc(buffer_, buffer_allocated_));
+}
+
+u1* Inflater::Inflate(const u1* data, size_t length, size_t size_hint,
+                      size_t* compressed_size, size_t* uncompressed_size) {
+  // Setting up a zlib stream allocates its 32K window, so set it up once and
+  // only reset it for the next files.
+  int ret;
+  if (!stream_initialized_) {
+    stream_.zalloc = Z_NULL;
+    stream_.zfree = Z_NULL;
+    stream_.opaque = Z_NULL;
+    stream_.avail_in = 0;
+    stream_.next_in = Z_NULL;
+    ret = inflateInit2(&stream_, -MAX_WBITS);
+    if (ret != Z_OK) {
+      return error("inflateInit: %d\n", ret);
+    }
+    stream_initialized_ = true;
+  } else {
+    ret = inflateReset(&stream_);
+    if (ret != Z_OK) {
+      return error("inflateReset: %d\n", ret);
+    }
+  }
+
+  // The size from the zip headers is usually right, so make room for all of
+  // it up front, plus a byte so that the end of the stream fits too.
+  if (size_hint >= buffer_allocated_ && buffer_allocated_ < MAX_BUFFER_SIZE) {
+    Resize(size_hint + 1);
+  }
+
+  stream_.avail_in = length;
+  stream_.next_in = const_cast<Bytef*>(data);
+
+  size_t uncompressed_until_now = 0;
+
+  while (true) {
+    stream_.avail_out = buffer_allocated_ - uncompressed_until_now;
+    stream_.next_out = buffer_ + uncompressed_until_now;
+    size_t old_avail_out = stream_.avail_out;
+
+    ret = inflate(&stream_, Z_SYNC_FLUSH);
+    uncompressed_until_now += old_avail_out - stream_.avail_out;
+
+    switch (ret) {
+      case Z_STREAM_END: {
+        // zlib said that there is no more data to decompress.
+        *compressed_size = stream_.next_in - data;
+        *uncompressed_size = uncompressed_until_now;
+        return buffer_;
+      }
+
+      case Z_OK: {
+        // zlib said that there is no more room in the buffer allocated for
+        // the decompressed data. Enlarge that buffer and try again.
+
+        if (buffer_allocated_ == MAX_BUFFER_SIZE) {
+          return error("ijar does not support decompressing files "
+                       "larger than %dMB.\n",
+                       (int) (MAX_BUFFER_SIZE/(1024*1024)));
+        }
+
+        Resize(buffer_allocated_ * 2);
+        break;
+      }
+
+      case Z_DATA_ERROR:
+      case Z_BUF_ERROR:
+      case Z_STREAM_ERROR:
+      case Z_NEED_DICT:
+      default: {
+        return error("zlib returned error code %d during inflate.\n", ret);
+      }
+    }
+  }
+}
+
 //
 // Implementation of InputZipFile
 //
@@ -328,6 +486,44 @@ bool InputZipFile::ProcessNext() {
 
 int InputZipFile::ProcessLocalFileEntry(
     size_t compressed_size, size_t uncompressed_size) {
+  if (ReadLocalFileHeader(compressed_size, uncompressed_size) < 0) {
+    return -1;
+  }
+
+  bool is_compressed = compression_method_ == COMPRESSION_METHOD_DEFLATED;
+  if (processor->Accept(filename, attr)) {
+    if (ProcessFile(is_compressed) < 0) {
+      return -1;
+    }
+  } else {
+    if (SkipFile(is_compressed) < 0) {
+      return -1;
+    }
+  }
+
+  if (general_purpose_bit_flag_ & GENERAL_PURPOSE_BIT_FLAG_COMPRESSED) {
+    // Skip the data descriptor. Some implementations do not put the signature
+    // here, so check if the next 4 bytes are a signature, and if so, skip the
+    // next 12 bytes (for CRC, compressed/uncompressed size), otherwise skip
+    // the next 8 bytes (because the value just read was the CRC).
+    u4 signature = get_u4le(p);
+    if (signature == DATA_DESCRIPTOR_SIGNATURE) {
+      p += 4 * 3;
+    } else {
+      p += 4 * 2;
+    }
+  }
+
+  if (p - zipdata_in_mapped_ > MAX_MAPPED_REGION) {
+    munmap(const_cast<u1*>(zipdata_in_mapped_), MAX_MAPPED_REGION);
+    zipdata_in_mapped_ += MAX_MAPPED_REGION;
+  }
+
+  return 0;
+}
+
+int InputZipFile::ReadLocalFileHeader(
+    size_t compressed_size, size_t uncompressed_size) {
   if (EnsureRemaining(26, "extract_version") < 0) {
     return -1;
   }
@@ -366,8 +562,6 @@ int InputZipFile::ProcessLocalFileEntry(
   extra_field_ = p;
   p += extra_field_length_;
 
-  bool is_compressed = compression_method_ == COMPRESSION_METHOD_DEFLATED;
-
   // If the zip is compressed, compressed and uncompressed size members are
   // zero in the local file header. If not, check that they are the same as the
   // lengths from the central directory, otherwise, just believe the central
@@ -388,34 +582,6 @@ int InputZipFile::ProcessLocalFileEntry(
     }
   }
 
-  if (processor->Accept(filename, attr)) {
-    if (ProcessFile(is_compressed) < 0) {
-      return -1;
-    }
-  } else {
-    if (SkipFile(is_compressed) < 0) {
-      return -1;
-    }
-  }
-
-  if (general_purpose_bit_flag_ & GENERAL_PURPOSE_BIT_FLAG_COMPRESSED) {
-    // Skip the data descriptor. Some implementations do not put the signature
-    // here, so check if the next 4 bytes are a signature, and if so, skip the
-    // next 12 bytes (for CRC, compressed/uncompressed size), otherwise skip
-    // the next 8 bytes (because the value just read was the CRC).
-    u4 signature = get_u4le(p);
-    if (signature == DATA_DESCRIPTOR_SIGNATURE) {
-      p += 4 * 3;
-    } else {
-      p += 4 * 2;
-    }
-  }
-
-  if (p - zipdata_in_mapped_ > MAX_MAPPED_REGION) {
-    munmap(const_cast<u1*>(zipdata_in_mapped_), MAX_MAPPED_REGION);
-    zipdata_in_mapped_ += MAX_MAPPED_REGION;
-  }
-
   return 0;
 }
 
@@ -439,74 +605,17 @@ int InputZipFile::SkipFile(const bool compressed) {
 u1* InputZipFile::UncompressFile() {
   size_t in_offset = p - zipdata_in_;
   size_t remaining = in_length_ - in_offset;
-  z_stream stream;
-
-  stream.zalloc = Z_NULL;
-  stream.zfree = Z_NULL;
-  stream.opaque = Z_NULL;
-  stream.avail_in = remaining;
-  stream.next_in = (Bytef *) p;
-
-  int ret = inflateInit2(&stream, -MAX_WBITS);
-  if (ret != Z_OK) {
-    error("inflateInit: %d\n", ret);
+  size_t compressed_size, uncompressed_size;
+  u1 *data = inflater_.Inflate(p, remaining, uncompressed_size_,
+                               &compressed_size, &uncompressed_size);
+  if (data == NULL) {
+    error("%s", inflater_.GetError());
     return NULL;
   }
-
-  int uncompressed_until_now = 0;
-
-  while (true) {
-    stream.avail_out = uncompressed_data_allocated_ - uncompressed_until_now;
-    stream.next_out = uncompressed_data_ + uncompressed_until_now;
-    int old_avail_out = stream.avail_out;
-
-    ret = inflate(&stream, Z_SYNC_FLUSH);
-    int uncompressed_now = old_avail_out - stream.avail_out;
-    uncompressed_until_now += uncompressed_now;
-
-    switch (ret) {
-      case Z_STREAM_END: {
-        // zlib said that there is no more data to decompress.
-
-        u1 *new_p = reinterpret_cast<u1*>(stream.next_in);
-        compressed_size_ = new_p - p;
-        uncompressed_size_ = uncompressed_until_now;
-        p = new_p;
-        inflateEnd(&stream);
-        return uncompressed_data_;
-      }
-
-      case Z_OK: {
-        // zlib said that there is no more room in the buffer allocated for
-        // the decompressed data. Enlarge that buffer and try again.
-
-        if (uncompressed_data_allocated_ == MAX_BUFFER_SIZE) {
-          error("ijar does not support decompressing files "
-                "larger than %dMB.\n",
-                (int) (MAX_BUFFER_SIZE/(1024*1024)));
-          return NULL;
-        }
-
-        uncompressed_data_allocated_ *= 2;
-        if (uncompressed_data_allocated_ > MAX_BUFFER_SIZE) {
-          uncompressed_data_allocated_ = MAX_BUFFER_SIZE;
-        }
-
-        uncompressed_data_ = reinterpret_cast<u1*>(
-            realloc(uncompressed_data_, uncompressed_data_allocated_));
-        break;
-      }
-
-      case Z_DATA_ERROR:
-      case Z_BUF_ERROR:
-      case Z_STREAM_ERROR:
-      case Z_NEED_DICT:
-      default: {
-        error("zlib returned error code %d during inflate.\n", ret);
-        return NULL;
-      }
-    }
-  }
+  compressed_size_ = compressed_size;
+  uncompressed_size_ = uncompressed_size;
+  p += compressed_size;
+  return data;
 }
 
 int InputZipFile::ProcessFile(const bool compressed) {
@@ -694,6 +803,203 @@ int ZipExtractor::ProcessAll() {
   return 0;
 }
 
+void ParallelZipExtractorProcessor::Process(const char* filename,
+                                            const u4 attr,
+                                            const u1* data,
+                                            const size_t size) {
+  std::vector<u1> out(size);
+  size_t length = Transform(filename, attr, data, size, out.data());
+  Store(filename, attr, out.data(), length);
+}
+
+// A file to be processed by ProcessAllParallel(), and its result.
+struct ParallelEntry {
+  std::string filename;
+  u4 attr;
+  const u1 *data;      // file data in the input mmap
+  size_t available;    // bytes from "data" to the end of the input
+  bool compressed;
+  size_t uncompressed_size;
+
+  // Set by the worker that processed it.
+  bool done;
+  const u1 *result;
+  size_t result_length;
+  std::string error;
+};
+
+int InputZipFile::ProcessAllParallel(ParallelZipExtractorProcessor *processor,
+                                     int num_threads) {
+  // Read the central directory and the local file headers on this thread.
+  // The central directory gives the offset of every file, so the data of
+  // each file can then be handled on its own.
+  std::vector<ParallelEntry> entries;
+  const u1 *current = central_dir_;
+  while (true) {
+    size_t compressed, uncompressed;
+    u4 offset;
+    if (!ProcessCentralDirEntry(current, &compressed, &uncompressed,
+                                filename, PATH_MAX, &attr, &offset)) {
+      break;
+    }
+    if (!processor->Accept(filename, attr)) {
+      continue;
+    }
+
+    p = zipdata_in_ + in_offset_ + offset;
+    if (EnsureRemaining(4, "signature") < 0) {
+      return -1;
+    }
+    if (get_u4le(p) != LOCAL_FILE_HEADER_SIGNATURE) {
+      return error("local file header signature for file %s not found\n",
+                   filename);
+    }
+    if (ReadLocalFileHeader(compressed, uncompressed) < 0) {
+      return -1;
+    }
+
+    ParallelEntry entry;
+    entry.filename = filename;
+    entry.attr = attr;
+    entry.data = p;
+    entry.available = in_length_ - (p - zipdata_in_);
+    entry.compressed = compression_method_ == COMPRESSION_METHOD_DEFLATED;
+    entry.uncompressed_size = uncompressed_size_;
+    entry.done = false;
+    entry.result = NULL;
+    entry.result_length = 0;
+    if (!entry.compressed) {
+      if (compressed_size_ != uncompressed_size_) {
+        return error("compressed size != uncompressed size, although the file "
+                     "is uncompressed.\n");
+      }
+      if (EnsureRemaining(compressed_size_, "file_data") < 0) {
+        return -1;
+      }
+    }
+    entries.push_back(entry);
+  }
+  Reset();
+
+  // Files are taken in order by whichever thread is free, as long as they
+  // are within the window of files after the one being stored. The result
+  // for entries[i] goes into the buffer slots[i % slots.size()]. Buffers are
+  // reused and only grow, like the Inflater's. This thread stores results in
+  // order and processes files itself while it waits, so it is one of the
+  // "num_threads" threads.
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  std::vector<std::vector<u1> > slots(num_threads * PARALLEL_WINDOW_PER_THREAD);
+  std::mutex mu;
+  std::condition_variable cv;
+  size_t next = 0;    // next entry for a thread to take
+  size_t stored = 0;  // entries stored so far
+  bool failed = false;
+
+  auto process = [&](size_t i, Inflater *inflater) {
+    ParallelEntry *entry = &entries[i];
+    std::vector<u1> *out = &slots[i % slots.size()];
+    const u1 *data = entry->data;
+    size_t size = entry->uncompressed_size;
+    std::string error;
+    if (entry->compressed) {
+      size_t compressed_size;
+      data = inflater->Inflate(entry->data, entry->available,
+                               entry->uncompressed_size,
+                               &compressed_size, &size);
+      if (data == NULL) {
+        error = inflater->GetError();
+      }
+    }
+    size_t result_length = 0;
+    if (data != NULL) {
+      if (out->size() < size) {
+        out->resize(size);
+      }
+      result_length = processor->Transform(entry->filename.c_str(),
+                                           entry->attr, data, size,
+                                           out->data());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      entry->done = true;
+      entry->result = out->data();
+      entry->result_length = result_length;
+      entry->error = error;
+    }
+    cv.notify_all();
+  };
+
+  auto worker = [&]() {
+    Inflater inflater;
+    while (true) {
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait(lock, [&] {
+          return failed || next == entries.size() ||
+              next < stored + slots.size();
+        });
+        if (failed || next == entries.size()) {
+          return;
+        }
+        i = next++;
+      }
+      process(i, &inflater);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int ii = 1; ii < num_threads; ++ii) {
+    threads.push_back(std::thread(worker));
+  }
+
+  int result = 0;
+  for (size_t ii = 0; ii < entries.size(); ++ii) {
+    ParallelEntry *entry = &entries[ii];
+    while (true) {
+      // More files only come into the window when this thread stores one,
+      // so if there is nothing to take, wait for the next result.
+      size_t i;
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        if (!entry->done && next < entries.size() &&
+            next < stored + slots.size()) {
+          i = next++;
+        } else {
+          cv.wait(lock, [&] { return entry->done; });
+          break;
+        }
+      }
+      process(i, &inflater_);
+    }
+
+    if (!entry->error.empty()) {
+      result = error("%s", entry->error.c_str());
+      break;
+    }
+    processor->Store(entry->filename.c_str(), entry->attr,
+                     entry->result, entry->result_length);
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      ++stored;
+    }
+    cv.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    failed = result < 0;
+  }
+  cv.notify_all();
+  for (size_t ii = 0; ii < threads.size(); ++ii) {
+    threads[ii].join();
+  }
+  return result;
+}
+
 ZipExtractor* ZipExtractor::Create(const char* filename,
                                    ZipExtractorProcessor *processor) {
   int fd_in = open(filename, O_RDONLY);
@@ -736,14 +1042,10 @@ InputZipFile::InputZipFile(ZipExtractorProcessor *processor, int fd,
     zipdata_in_(zipdata_in), zipdata_in_mapped_(zipdata_in),
     central_dir_(central_dir), in_length_(in_length), in_offset_(in_offset),
     p(zipdata_in + in_offset), central_dir_current_(central_dir) {
-  uncompressed_data_allocated_ = INITIAL_BUFFER_SIZE;
-  uncompressed_data_ =
-    reinterpret_cast<u1*>(malloc(uncompressed_data_allocated_));
   errmsg[0] = 0;
 }
 
 InputZipFile::~InputZipFile() {
-  free(uncompressed_data_);
   close(fd_in);
 }
 
@@ -122,6 +122,32 @@ class ZipExtractorProcessor {
                        const u1* data, const size_t size) = 0;
 };
 
+//
+// A ZipExtractorProcessor whose work on a file can run on worker threads.
+// ZipExtractor::ProcessAllParallel() calls Transform() for several files at
+// once from different threads, then Store() for each result in the order of
+// the input ZIP. ProcessAll() still calls Process(), which by default does
+// both in turn.
+//
+class ParallelZipExtractorProcessor : public ZipExtractorProcessor {
+ public:
+  virtual ~ParallelZipExtractorProcessor() {}
+
+  // Transform a file accepted by Accept into the buffer pointed by "out",
+  // which has room for "size" bytes, and return the length of the result.
+  // Must not touch state shared with other calls.
+  virtual size_t Transform(const char* filename, const u4 attr,
+                           const u1* data, const size_t size, u1* out) = 0;
+
+  // Store the "size" bytes at "data" that Transform() produced for the file
+  // "filename".
+  virtual void Store(const char* filename, const u4 attr,
+                     const u1* data, const size_t size) = 0;
+
+  virtual void Process(const char* filename, const u4 attr,
+                       const u1* data, const size_t size);
+};
+
 //
 // Class interface for reading ZIP files
 //
@@ -142,6 +168,13 @@ class ZipExtractor {
   // on error).
   virtual int ProcessAll();
 
+  // Process all files with "processor" rather than the processor provided
+  // to the Create method, inflating and transforming up to "num_threads"
+  // files at once. The output is the same as ProcessAll() would produce.
+  // Returns -1 on error (GetError() will be populated on error).
+  virtual int ProcessAllParallel(ParallelZipExtractorProcessor *processor,
+                                 int num_threads) = 0;
+
   // Reset the file pointer to the beginning.
   virtual void Reset() = 0;
 
@@ -94,6 +94,9 @@ class Platform(object):
     def supports_ppoll(self):
         return self._platform in ('linux', 'openbsd', 'bitrig')
 
+    def supports_epoll(self):
+        return self._platform == 'linux'
+
     def supports_ninja_browse(self):
         return not self.is_windows() and not self.is_solaris()
 
@@ -196,8 +199,9 @@ parser.add_option('--with-python', metavar='EXE',
                   help='use EXE as the Python interpreter',
                   default=os.path.basename(sys.executable))
 parser.add_option('--force-pselect', action='store_true',
-                  help='ppoll() is used by default where available, '
-                       'but some platforms may need to use pselect instead',)
+                  help='epoll() or ppoll() is used by default where '
+                       'available, but some platforms may need to use '
+                       'pselect instead',)
 (options, args) = parser.parse_args()
 if args:
     print('ERROR: extra unparsed command-line arguments:', args)
@@ -341,7 +345,14 @@ else:
         cflags.append('-fno-omit-frame-pointer')
         libs.extend(['-Wl,--no-as-needed', '-lprofiler'])
 
-if platform.supports_ppoll() and not options.force_pselect:
+if not platform.is_windows():
+    # The manifest parser lexes subninja files on several threads.
+    cflags.append('-pthread')
+    ldflags.append('-pthread')
+
+if platform.supports_epoll() and not options.force_pselect:
+    cflags.append('-DUSE_EPOLL')
+elif platform.supports_ppoll() and not options.force_pselect:
     cflags.append('-DUSE_PPOLL')
 if platform.supports_ninja_browse():
     cflags.append('-DNINJA_HAVE_BROWSE')
@@ -438,7 +449,8 @@ else:
 n.newline()
 
 n.comment('Core source files all build into ninja library.')
-for name in ['build',
+for name in ['action_cache',
+             'build',
              'build_log',
              'clean',
              'debug_flags',
@@ -453,6 +465,7 @@ for name in ['build',
              'line_printer',
              'manifest_parser',
              'metrics',
+             'sha256',
              'state',
              'util',
              'version']:
@@ -498,7 +511,8 @@ n.comment('Tests all build into ninja_test executable.')
 
 objs = []
 
-for name in ['build_log_test',
+for name in ['action_cache_test',
+             'build_log_test',
              'build_test',
              'clean_test',
              'depfile_parser_test',
@@ -509,6 +523,7 @@ for name in ['build_log_test',
              'lexer_test',
              'manifest_parser_test',
              'ninja_test',
+             'sha256_test',
              'state_test',
              'subprocess_test',
              'test',
@@ -531,6 +546,12 @@ all_targets += n.build(binary('build_log_perftest'), 'link', objs,
 objs = cxx('canon_perftest')
 all_targets += n.build(binary('canon_perftest'), 'link', objs,
                        implicit=ninja_lib, variables=[('libs', libs)])
+objs = cxx('critical_path_perftest')
+all_targets += n.build(binary('critical_path_perftest'), 'link', objs,
+                       implicit=ninja_lib, variables=[('libs', libs)])
+objs = cxx('deps_log_perftest')
+all_targets += n.build(binary('deps_log_perftest'), 'link', objs,
+                       implicit=ninja_lib, variables=[('libs', libs)])
 objs = cxx('depfile_parser_perftest')
 all_targets += n.build(binary('depfile_parser_perftest'), 'link', objs,
                        implicit=ninja_lib, variables=[('libs', libs)])
@@ -540,6 +561,10 @@ all_targets += n.build(binary('hash_collision_bench'), 'link', objs,
 objs = cxx('manifest_parser_perftest')
 all_targets += n.build(binary('manifest_parser_perftest'), 'link', objs,
                               implicit=ninja_lib, variables=[('libs', libs)])
+if not platform.is_windows():
+    objs = cxx('subprocess_perftest')
+    all_targets += n.build(binary('subprocess_perftest'), 'link', objs,
+                           implicit=ninja_lib, variables=[('libs', libs)])
 n.newline()
 
 n.comment('Generate a graph using the "graph" tool.')
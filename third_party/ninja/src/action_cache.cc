@@ -0,0 +1,532 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include <algorithm>
+
+#include "disk_interface.h"
+#include "graph.h"
+#include "metrics.h"
+#include "sha256.h"
+
+// The cache directory holds two kinds of files, both spread over
+// subdirectories named after the first two characters of their names:
+//
+//   actions/ab/ab01...   One entry per command and outputs.
+//   blobs/ab/ab01...     Output contents.
+//
+// and a file 'size' with the running total of their sizes, for Trim().
+// Entries, blobs and input contents are all named by their SHA-256, in hex.
+// A collision would restore wrong outputs without an error, so a fast but
+// weaker hash won't do.
+//
+// An entry is a text file of variants, most recently stored first:
+//
+//   # ninja action cache v2
+//   variant <blob of the console output, or ->
+//   in <SHA-256 of the contents> <path>
+//   out <blob> <octal mode> <path>
+//
+// Files are written to a temporary name and renamed into place, so that
+// several ninja processes can share a cache.
+
+namespace {
+
+const char kFileSignature[] = "# ninja action cache v2\n";
+
+/// Variants kept per entry, enough for a few branches to share a cache.
+const size_t kMaxVariants = 8;
+
+/// Path of file \a name in the cache subdirectory \a kind.
+string CachePath(const string& dir, const char* kind, const string& name) {
+  return dir + "/" + kind + "/" + name.substr(0, 2) + "/" + name;
+}
+
+bool FileExists(const string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+#ifndef _WIN32
+
+/// Mark \a path as recently used, for Trim().
+void Touch(const string& path) {
+  utime(path.c_str(), NULL);
+}
+
+/// Replace \a path with \a size bytes at \a data and the given \a mode,
+/// such that readers see either the old or the new contents.
+bool WriteFileAtomically(const string& path, const char* data, size_t size,
+                         int mode) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+  string temp = path + suffix;
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    return false;
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      close(fd);
+      unlink(temp.c_str());
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  // fchmod() rather than the mode to open(), which the umask would change.
+  if (fchmod(fd, mode) < 0 || close(fd) < 0 ||
+      rename(temp.c_str(), path.c_str()) < 0) {
+    unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+#endif  // !_WIN32
+
+void RecordMiss() {
+  METRIC_COUNT("action cache miss");
+}
+
+}  // namespace
+
+struct ActionCache::Variant {
+  struct Output {
+    Output(const string& path, const string& blob, int mode)
+        : path(path), blob(blob), mode(mode) {}
+    string path;
+    string blob;
+    int mode;
+  };
+
+  /// The blob holding what the command printed, or empty.
+  string console_blob;
+  /// Content hashes of the inputs, by path.
+  map<string, string> inputs;
+  /// The outputs, including the depfile.
+  vector<Output> outputs;
+
+  /// Parse the variants of an entry, or return false if it is corrupt.
+  static bool Parse(const string& contents, vector<Variant>* variants);
+
+  /// Append the text form of this variant to \a out.
+  void Format(string* out) const;
+};
+
+bool ActionCache::Variant::Parse(const string& contents,
+                                 vector<Variant>* variants) {
+  const size_t kSignatureLength = sizeof(kFileSignature) - 1;
+  if (contents.compare(0, kSignatureLength, kFileSignature) != 0)
+    return false;
+
+  size_t pos = kSignatureLength;
+  while (pos < contents.size()) {
+    size_t end = contents.find('\n', pos);
+    if (end == string::npos)
+      return false;
+    string line = contents.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (line.compare(0, 8, "variant ") == 0) {
+      variants->push_back(Variant());
+      string blob = line.substr(8);
+      if (blob != "-")
+        variants->back().console_blob = blob;
+      continue;
+    }
+    if (variants->empty())
+      return false;
+    Variant* variant = &variants->back();
+
+    if (line.compare(0, 3, "in ") == 0) {
+      size_t hash_end = line.find(' ', 3);
+      if (hash_end == string::npos)
+        return false;
+      variant->inputs[line.substr(hash_end + 1)] =
+          line.substr(3, hash_end - 3);
+    } else if (line.compare(0, 4, "out ") == 0) {
+      size_t blob_end = line.find(' ', 4);
+      if (blob_end == string::npos)
+        return false;
+      char* path;
+      int mode = (int)strtol(line.c_str() + blob_end + 1, &path, 8);
+      if (*path != ' ')
+        return false;
+      variant->outputs.push_back(
+          Output(path + 1, line.substr(4, blob_end - 4), mode));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ActionCache::Variant::Format(string* out) const {
+  *out += "variant " + (console_blob.empty() ? "-" : console_blob) + "\n";
+  for (map<string, string>::const_iterator i = inputs.begin();
+       i != inputs.end(); ++i) {
+    *out += "in " + i->second + " " + i->first + "\n";
+  }
+  for (vector<Output>::const_iterator i = outputs.begin(); i != outputs.end();
+       ++i) {
+    char mode[16];
+    snprintf(mode, sizeof(mode), "%o", i->mode);
+    *out += "out " + i->blob + " " + mode + " " + i->path + "\n";
+  }
+}
+
+ActionCache::ActionCache(DiskInterface* disk_interface)
+    : disk_interface_(disk_interface), max_size_(0), stored_size_(0) {}
+
+bool ActionCache::Open(const string& dir, int64_t max_size, string* err) {
+#ifdef _WIN32
+  *err = "the action cache is not supported on Windows";
+  return false;
+#else
+  dir_ = dir;
+  max_size_ = max_size;
+  if (!disk_interface_->MakeDirs(dir_ + "/actions/") ||
+      !disk_interface_->MakeDirs(dir_ + "/blobs/")) {
+    *err = "creating " + dir_ + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+#endif
+}
+
+// static
+bool ActionCache::IsCacheable(Edge* edge) {
+  if (edge->is_phony() || edge->use_console() ||
+      edge->GetBindingBool("generator"))
+    return false;
+  if (edge->GetBinding("deps").empty() &&
+      !edge->GetUnescapedDepfile().empty())
+    return false;
+  return true;
+}
+
+// static
+set<string> ActionCache::InputPaths(Edge* edge) {
+  set<string> paths;
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end() - edge->order_only_deps_; ++i) {
+    paths.insert((*i)->path());
+  }
+  return paths;
+}
+
+string ActionCache::EntryPath(Edge* edge) const {
+  string key = edge->EvaluateCommand(true);
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    key += "\n" + (*o)->path();
+  }
+  key += "\n" + edge->GetUnescapedDepfile();
+  return CachePath(dir_, "actions", Sha256Hex(key));
+}
+
+bool ActionCache::HashFile(const string& path, string* hash) {
+  map<string, string>::iterator i = hashes_.find(path);
+  if (i != hashes_.end()) {
+    *hash = i->second;
+    return true;
+  }
+
+  // Directories fail to map, so they are never considered up to date.
+  MappedFile file;
+  string err;
+  if (file.Open(path, &err) < 0)
+    return false;
+  *hash = Sha256Hex(StringPiece(file.data(), file.size()));
+  hashes_[path] = *hash;
+  return true;
+}
+
+bool ActionCache::Restore(Edge* edge, string* output) {
+  METRIC_RECORD("action cache lookup");
+#ifdef _WIN32
+  return false;
+#else
+  string entry_path = EntryPath(edge);
+  string contents, err;
+  vector<Variant> variants;
+  if (::ReadFile(entry_path, &contents, &err) < 0 ||
+      !Variant::Parse(contents, &variants)) {
+    RecordMiss();
+    return false;
+  }
+
+  set<string> inputs = InputPaths(edge);
+  for (vector<Variant>::iterator v = variants.begin(); v != variants.end();
+       ++v) {
+    // The edge may not have gained inputs since the variant was stored...
+    bool match = true;
+    for (set<string>::iterator i = inputs.begin(); match && i != inputs.end();
+         ++i) {
+      match = v->inputs.count(*i) != 0;
+    }
+    // ...and everything the command read must be unchanged.
+    for (map<string, string>::iterator i = v->inputs.begin();
+         match && i != v->inputs.end(); ++i) {
+      string hash;
+      match = HashFile(i->first, &hash) && hash == i->second;
+    }
+    if (!match)
+      continue;
+
+    // Check for every blob first, so that a partly trimmed variant isn't
+    // half restored.
+    vector<string> blob_paths;
+    for (vector<Variant::Output>::iterator o = v->outputs.begin();
+         match && o != v->outputs.end(); ++o) {
+      blob_paths.push_back(CachePath(dir_, "blobs", o->blob));
+      match = FileExists(blob_paths.back());
+    }
+    output->clear();
+    if (match && !v->console_blob.empty()) {
+      string console_path = CachePath(dir_, "blobs", v->console_blob);
+      match = ::ReadFile(console_path, output, &err) == 0;
+      Touch(console_path);
+    }
+    for (size_t i = 0; match && i < v->outputs.size(); ++i) {
+      MappedFile blob;
+      hashes_.erase(v->outputs[i].path);
+      match = blob.Open(blob_paths[i], &err) == 0 &&
+          disk_interface_->MakeDirs(v->outputs[i].path) &&
+          WriteFileAtomically(v->outputs[i].path, blob.data(), blob.size(),
+                              v->outputs[i].mode);
+      Touch(blob_paths[i]);
+    }
+    if (!match) {
+      // The command runs and overwrites whatever was restored.
+      RecordMiss();
+      return false;
+    }
+
+    Touch(entry_path);
+    restored_.insert(edge);
+    METRIC_COUNT("action cache hit");
+    return true;
+  }
+
+  RecordMiss();
+  return false;
+#endif  // !_WIN32
+}
+
+void ActionCache::EdgeFinished(Edge* edge, const string& output,
+                               const string& depfile_content,
+                               const vector<Node*>& deps) {
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    hashes_.erase((*o)->path());
+  }
+  if (restored_.erase(edge) || !IsCacheable(edge))
+    return;
+  Store(edge, output, depfile_content, deps);
+}
+
+bool ActionCache::WriteBlob(const char* data, size_t size, string* name) {
+#ifdef _WIN32
+  return false;
+#else
+  *name = Sha256Hex(StringPiece(data, size));
+  string path = CachePath(dir_, "blobs", *name);
+  if (FileExists(path)) {
+    Touch(path);
+    return true;
+  }
+  if (!disk_interface_->MakeDirs(path) ||
+      !WriteFileAtomically(path, data, size, 0644))
+    return false;
+  stored_size_ += size;
+  return true;
+#endif
+}
+
+bool ActionCache::Store(Edge* edge, const string& output,
+                        const string& depfile_content,
+                        const vector<Node*>& deps) {
+  METRIC_RECORD("action cache store");
+#ifdef _WIN32
+  return false;
+#else
+  Variant variant;
+  set<string> inputs = InputPaths(edge);
+  for (vector<Node*>::const_iterator i = deps.begin(); i != deps.end(); ++i)
+    inputs.insert((*i)->path());
+  for (set<string>::iterator i = inputs.begin(); i != inputs.end(); ++i) {
+    if (!HashFile(*i, &variant.inputs[*i]))
+      return false;
+  }
+
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    struct stat st;
+    MappedFile file;
+    string err, blob;
+    if (stat((*o)->path().c_str(), &st) < 0 || !S_ISREG(st.st_mode) ||
+        file.Open((*o)->path(), &err) < 0 ||
+        !WriteBlob(file.data(), file.size(), &blob))
+      return false;
+    variant.outputs.push_back(
+        Variant::Output((*o)->path(), blob, st.st_mode & 07777));
+  }
+  if (!depfile_content.empty()) {
+    string blob;
+    if (!WriteBlob(depfile_content.data(), depfile_content.size(), &blob))
+      return false;
+    variant.outputs.push_back(
+        Variant::Output(edge->GetUnescapedDepfile(), blob, 0644));
+  }
+  if (!output.empty() &&
+      !WriteBlob(output.data(), output.size(), &variant.console_blob))
+    return false;
+
+  // Put the new variant first, replacing any older one for the same inputs.
+  string entry_path = EntryPath(edge);
+  string contents, err;
+  vector<Variant> variants;
+  if (::ReadFile(entry_path, &contents, &err) < 0 ||
+      !Variant::Parse(contents, &variants))
+    variants.clear();
+  contents = kFileSignature;
+  variant.Format(&contents);
+  size_t kept = 1;
+  for (vector<Variant>::iterator v = variants.begin();
+       v != variants.end() && kept < kMaxVariants; ++v) {
+    if (v->inputs == variant.inputs)
+      continue;
+    v->Format(&contents);
+    ++kept;
+  }
+  if (!disk_interface_->MakeDirs(entry_path) ||
+      !WriteFileAtomically(entry_path, contents.data(), contents.size(),
+                           0644))
+    return false;
+  stored_size_ += contents.size();
+  return true;
+#endif  // !_WIN32
+}
+
+void ActionCache::Trim() {
+#ifndef _WIN32
+  if (stored_size_ == 0)
+    return;
+
+  // Keep a running total rather than walking the whole cache after every
+  // build.  Processes sharing the cache may lose each other's updates, and
+  // replaced entries are counted twice, so the total is only an estimate;
+  // walking the cache when it goes over the limit corrects it.
+  string size_path = dir_ + "/size";
+  string contents, err;
+  int64_t total = -1;
+  if (::ReadFile(size_path, &contents, &err) == 0) {
+    char* end;
+    total = strtoll(contents.c_str(), &end, 10);
+    if (end == contents.c_str() || *end != '\n' || total < 0)
+      total = -1;
+  }
+  if (total >= 0)
+    total += stored_size_;
+  stored_size_ = 0;
+  if (total < 0 || total > max_size_)
+    total = TrimFiles();
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%" PRId64 "\n", total);
+  WriteFileAtomically(size_path, buf, strlen(buf), 0644);
+#endif  // !_WIN32
+}
+
+int64_t ActionCache::TrimFiles() {
+  int64_t total = 0;
+#ifndef _WIN32
+  METRIC_RECORD("action cache trim");
+
+  struct CacheFile {
+    time_t mtime;
+    int64_t size;
+    string path;
+    bool operator<(const CacheFile& other) const {
+      return mtime < other.mtime;
+    }
+  };
+  vector<CacheFile> files;
+  const char* kKinds[] = { "actions", "blobs" };
+  for (size_t k = 0; k < sizeof(kKinds) / sizeof(kKinds[0]); ++k) {
+    string kind_dir = dir_ + "/" + kKinds[k];
+    DIR* kind = opendir(kind_dir.c_str());
+    if (!kind)
+      continue;
+    while (dirent* sub = readdir(kind)) {
+      if (sub->d_name[0] == '.')
+        continue;
+      string sub_dir = kind_dir + "/" + sub->d_name;
+      DIR* dir = opendir(sub_dir.c_str());
+      if (!dir)
+        continue;
+      while (dirent* ent = readdir(dir)) {
+        CacheFile file;
+        file.path = sub_dir + "/" + ent->d_name;
+        struct stat st;
+        if (ent->d_name[0] == '.' || stat(file.path.c_str(), &st) < 0)
+          continue;
+        file.mtime = st.st_mtime;
+        file.size = st.st_size;
+        files.push_back(file);
+        total += file.size;
+      }
+      closedir(dir);
+    }
+    closedir(kind);
+  }
+  if (total <= max_size_)
+    return total;
+
+  // Go a tenth below the limit, so that the next builds don't have to trim
+  // again right away.
+  sort(files.begin(), files.end());
+  int64_t target = max_size_ - max_size_ / 10;
+  for (vector<CacheFile>::iterator i = files.begin();
+       i != files.end() && total > target; ++i) {
+    if (unlink(i->path.c_str()) == 0)
+      total -= i->size;
+  }
+#endif  // !_WIN32
+  return total;
+}
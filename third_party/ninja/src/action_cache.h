@@ -0,0 +1,115 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ACTION_CACHE_H_
+#define NINJA_ACTION_CACHE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "util.h"  // int64_t
+
+struct DiskInterface;
+struct Edge;
+struct Node;
+
+/// A local, content-addressed cache of the outputs of edges.
+///
+/// Entries are found by the SHA-256 of an edge's command and output paths.
+/// An entry holds a few variants, each listing the inputs the command saw --
+/// its non-order-only inputs and the deps it reported -- with the SHA-256 of
+/// their contents, and the outputs, depfile and console output it produced.
+/// A variant matches when all its inputs still have the same contents and
+/// the edge has no inputs it didn't list.  Output contents are stored once
+/// per distinct content, so switching branches back and forth or building
+/// a fresh checkout can restore outputs instead of running commands.
+///
+/// The cache lives in a directory that may be shared by several build
+/// directories.  It is trimmed back below a size limit, dropping the least
+/// recently used files first.  A running total of its size is kept in the
+/// directory, so that it is only walked when it may be over the limit.
+struct ActionCache {
+  explicit ActionCache(DiskInterface* disk_interface);
+
+  /// Use the cache in directory \a dir, creating it if needed.  Trim()
+  /// keeps it at most \a max_size bytes.
+  /// @return false on error.
+  bool Open(const string& dir, int64_t max_size, string* err);
+
+  /// Whether the outputs of \a edge can be cached at all.  Commands that
+  /// write a depfile without 'deps' (whose deps are only known after the
+  /// next manifest load), console commands and generators are never
+  /// cached.
+  static bool IsCacheable(Edge* edge);
+
+  /// Look up \a edge, whose inputs must be up to date.  On a hit, write its
+  /// outputs and depfile back, set \a output to what the command printed
+  /// and return true.
+  bool Restore(Edge* edge, string* output);
+
+  /// Update the cache after \a edge finished successfully, storing its
+  /// outputs unless it was restored.  \a output is the unfiltered console
+  /// output of the command, \a depfile_content the depfile for 'deps = gcc'
+  /// (which is gone by the time the edge finishes) and \a deps the deps it
+  /// reported.
+  void EdgeFinished(Edge* edge, const string& output,
+                    const string& depfile_content, const vector<Node*>& deps);
+
+  /// Add what was stored since the last trim to the cache's running size
+  /// total, and if that is over the size limit (or there is no total yet),
+  /// walk the cache and remove the least recently used files.
+  void Trim();
+
+ private:
+  struct Variant;
+
+  /// Hash the contents of \a path, remembering the result for the rest of
+  /// the build.  @return false if it isn't a readable regular file.
+  bool HashFile(const string& path, string* hash);
+
+  /// The paths of the inputs that \a edge's command may read.
+  static set<string> InputPaths(Edge* edge);
+
+  /// Path of the entry for \a edge.
+  string EntryPath(Edge* edge) const;
+
+  /// Store \a data as a blob and return its name.
+  bool WriteBlob(const char* data, size_t size, string* name);
+
+  /// Add a variant for \a edge, which just ran, to its entry.
+  bool Store(Edge* edge, const string& output, const string& depfile_content,
+             const vector<Node*>& deps);
+
+  /// Walk the cache, removing the least recently used files if it is over
+  /// its size limit.  @return the bytes left.
+  int64_t TrimFiles();
+
+  DiskInterface* disk_interface_;
+  string dir_;
+  int64_t max_size_;
+  /// Bytes written since the last trim.
+  int64_t stored_size_;
+
+  /// Content hashes of files looked at during this build.  Outputs are
+  /// forgotten when their edge finishes.
+  map<string, string> hashes_;
+
+  /// Edges whose outputs came from the cache.
+  set<Edge*> restored_;
+};
+
+#endif  // NINJA_ACTION_CACHE_H_
@@ -0,0 +1,253 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#ifndef _WIN32
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "disk_interface.h"
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+namespace {
+
+struct ActionCacheTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    // These tests do real disk accesses, so create a temp dir.
+    temp_dir_.CreateAndEnter("Ninja-ActionCacheTest");
+  }
+
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  /// A cache as a new build sees it, without remembered file hashes.
+  ActionCache* NewCache(int64_t max_size = 1 << 20) {
+    cache_.reset(new ActionCache(&disk_));
+    string err;
+    EXPECT_TRUE(cache_->Open("cache", max_size, &err));
+    EXPECT_EQ("", err);
+    return cache_.get();
+  }
+
+  void WriteFile(const string& path, const string& contents) {
+    ASSERT_TRUE(disk_.WriteFile(path, contents));
+  }
+
+  string ReadFile(const string& path) {
+    string err;
+    return disk_.ReadFile(path, &err);
+  }
+
+  Edge* GetEdge(const char* output) {
+    return GetNode(output)->in_edge();
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_;
+  auto_ptr<ActionCache> cache_;
+};
+
+TEST_F(ActionCacheTest, StoreAndRestore) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in1 in2 || order\n"));
+  Edge* edge = GetEdge("out");
+  WriteFile("in1", "one");
+  WriteFile("in2", "two");
+  WriteFile("out", "onetwo");
+  ASSERT_EQ(0, chmod("out", 0751));
+
+  NewCache()->EdgeFinished(edge, "some output\n", "", vector<Node*>());
+
+  // Restored outputs get their contents, mode and console output back.
+  ASSERT_EQ(0, unlink("out"));
+  string output;
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+  EXPECT_EQ("some output\n", output);
+  EXPECT_EQ("onetwo", ReadFile("out"));
+  struct stat st;
+  ASSERT_EQ(0, stat("out", &st));
+  EXPECT_EQ(0751, (int)(st.st_mode & 07777));
+
+  // Order-only inputs don't matter.
+  WriteFile("order", "anything");
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+}
+
+TEST_F(ActionCacheTest, ChangedInputs) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in\n"));
+  Edge* edge = GetEdge("out");
+  WriteFile("in", "old");
+  WriteFile("out", "old out");
+  NewCache()->EdgeFinished(edge, "", "", vector<Node*>());
+
+  string output;
+  WriteFile("in", "new");
+  EXPECT_FALSE(NewCache()->Restore(edge, &output));
+  WriteFile("out", "new out");
+  NewCache()->EdgeFinished(edge, "", "", vector<Node*>());
+
+  // Both variants are kept.
+  WriteFile("in", "old");
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+  EXPECT_EQ("old out", ReadFile("out"));
+  WriteFile("in", "new");
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+  EXPECT_EQ("new out", ReadFile("out"));
+
+  // A missing input never matches.
+  ASSERT_EQ(0, unlink("in"));
+  EXPECT_FALSE(NewCache()->Restore(edge, &output));
+}
+
+TEST_F(ActionCacheTest, ChangedCommand) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out $flags\n"
+"build out1: touch in\n"
+"build out2: touch in\n"
+"  flags = -a\n"));
+  WriteFile("in", "");
+  WriteFile("out1", "");
+  NewCache()->EdgeFinished(GetEdge("out1"), "", "", vector<Node*>());
+
+  string output;
+  EXPECT_TRUE(NewCache()->Restore(GetEdge("out1"), &output));
+  EXPECT_FALSE(NewCache()->Restore(GetEdge("out2"), &output));
+}
+
+TEST_F(ActionCacheTest, Deps) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in\n"
+"  depfile = $out.d\n"
+"  deps = gcc\n"
+"build out: cc in\n"));
+  Edge* edge = GetEdge("out");
+  WriteFile("in", "#include \"header\"");
+  WriteFile("header", "one");
+  WriteFile("out", "compiled");
+  vector<Node*> deps;
+  deps.push_back(GetNode("header"));
+  NewCache()->EdgeFinished(edge, "", "out: in header\n", deps);
+
+  // The depfile comes back for the build to read deps from.
+  string output;
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+  EXPECT_EQ("out: in header\n", ReadFile("out.d"));
+
+  WriteFile("header", "two");
+  EXPECT_FALSE(NewCache()->Restore(edge, &output));
+}
+
+TEST_F(ActionCacheTest, NotCacheable) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule depfile\n"
+"  command = cc $in\n"
+"  depfile = $out.d\n"
+"rule regen\n"
+"  command = configure\n"
+"  generator = 1\n"
+"build out1: depfile in\n"
+"build out2: regen in\n"
+"build out3: phony in\n"
+"build out4: cat in\n"
+"  pool = console\n"
+"build out5: cat in\n"));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetEdge("out1")));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetEdge("out2")));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetEdge("out3")));
+  EXPECT_FALSE(ActionCache::IsCacheable(GetEdge("out4")));
+  EXPECT_TRUE(ActionCache::IsCacheable(GetEdge("out5")));
+}
+
+TEST_F(ActionCacheTest, RestoredEdgesAreNotStored) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in\n"));
+  Edge* edge = GetEdge("out");
+  WriteFile("in", "in");
+  WriteFile("out", "out");
+  NewCache()->EdgeFinished(edge, "", "", vector<Node*>());
+
+  // Nothing new is written, so there is nothing to trim even though the
+  // cache is over its limit.
+  ActionCache* cache = NewCache(1);
+  string output;
+  EXPECT_TRUE(cache->Restore(edge, &output));
+  cache->EdgeFinished(edge, output, "", vector<Node*>());
+  cache->Trim();
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+}
+
+TEST_F(ActionCacheTest, Trim) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in\n"));
+  Edge* edge = GetEdge("out");
+  WriteFile("in", "in");
+  WriteFile("out", "out");
+
+  ActionCache* cache = NewCache();
+  cache->EdgeFinished(edge, "", "", vector<Node*>());
+  cache->Trim();
+  string output;
+  EXPECT_TRUE(NewCache()->Restore(edge, &output));
+
+  cache = NewCache(1);
+  cache->EdgeFinished(edge, "", "", vector<Node*>());
+  cache->Trim();
+  EXPECT_FALSE(NewCache()->Restore(edge, &output));
+}
+
+TEST_F(ActionCacheTest, TrimKeepsSizeTotal) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in\n"));
+  Edge* edge = GetEdge("out");
+  WriteFile("in", "in");
+  WriteFile("out", "out");
+
+  // With no total yet, the cache is walked.
+  ActionCache* cache = NewCache();
+  cache->EdgeFinished(edge, "", "", vector<Node*>());
+  cache->Trim();
+  int64_t size = atoll(ReadFile("cache/size").c_str());
+  EXPECT_GT(size, 0);
+  EXPECT_LT(size, 1000);
+
+  // Below the limit, what was stored is added to the total without walking
+  // the cache, so a wrong total stays wrong.
+  WriteFile("cache/size", "1000\n");
+  cache = NewCache();
+  cache->EdgeFinished(edge, "", "", vector<Node*>());
+  cache->Trim();
+  EXPECT_GT(atoll(ReadFile("cache/size").c_str()), 1000);
+
+  // An unreadable total is rebuilt by walking the cache.
+  WriteFile("cache/size", "garbage");
+  cache = NewCache();
+  cache->EdgeFinished(edge, "", "", vector<Node*>());
+  cache->Trim();
+  EXPECT_EQ(size, atoll(ReadFile("cache/size").c_str()));
+}
+
+}  // namespace
+
+#endif  // !_WIN32
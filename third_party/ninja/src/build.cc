@@ -24,6 +24,7 @@
 #include <sys/termios.h>
 #endif
 
+#include "action_cache.h"
 #include "build_log.h"
 #include "debug_flags.h"
 #include "depfile_parser.h"
@@ -451,6 +452,104 @@ void Plan::CleanNode(DependencyScan* scan, Node* node) {
   }
 }
 
+void Plan::ComputeCriticalPath(BuildLog* build_log) {
+  METRIC_RECORD("critical path");
+
+  // Estimate each edge's own cost from the longest recorded duration of any
+  // of its outputs.  Phony edges and edges we don't want to run are free.
+  map<Edge*, int64_t> cost;
+  int64_t known_total = 0;
+  int known_count = 0;
+  vector<Edge*> unknown;
+  for (map<Edge*, bool>::iterator e = want_.begin(); e != want_.end(); ++e) {
+    Edge* edge = e->first;
+    int64_t duration = -1;
+    if (e->second && !edge->is_phony() && build_log) {
+      for (vector<Node*>::iterator o = edge->outputs_.begin();
+           o != edge->outputs_.end(); ++o) {
+        BuildLog::LogEntry* entry = build_log->LookupByOutput((*o)->path());
+        if (entry && entry->end_time >= entry->start_time)
+          duration = max(duration,
+                         (int64_t)(entry->end_time - entry->start_time));
+      }
+    }
+    if (!e->second || edge->is_phony()) {
+      cost[edge] = 0;
+    } else if (duration < 0) {
+      unknown.push_back(edge);
+    } else {
+      cost[edge] = duration;
+      known_total += duration;
+      ++known_count;
+    }
+  }
+  int64_t estimate = known_count ? max(known_total / known_count, (int64_t)1)
+                                 : 1;
+  for (vector<Edge*>::iterator e = unknown.begin(); e != unknown.end(); ++e)
+    cost[*e] = estimate;
+
+  // Count, for each edge, the inputs of wanted edges it produces.  Edges
+  // that nothing in the plan depends on are the ends of their chains.
+  map<Edge*, int> dependents;
+  for (map<Edge*, bool>::iterator e = want_.begin(); e != want_.end(); ++e) {
+    dependents.insert(make_pair(e->first, 0));
+    for (vector<Node*>::iterator i = e->first->inputs_.begin();
+         i != e->first->inputs_.end(); ++i) {
+      Edge* in_edge = (*i)->in_edge();
+      if (in_edge && want_.count(in_edge))
+        ++dependents[in_edge];
+    }
+  }
+
+  // Walk the plan from the final edges back towards the leaves.  An edge is
+  // visited once all of its dependents are, so by then the longest chain
+  // below it is known.
+  map<Edge*, int64_t> downstream;
+  vector<Edge*> work;
+  for (map<Edge*, int>::iterator e = dependents.begin();
+       e != dependents.end(); ++e) {
+    if (e->second == 0)
+      work.push_back(e->first);
+  }
+  while (!work.empty()) {
+    Edge* edge = work.back();
+    work.pop_back();
+    edge->critical_path_weight_ = cost[edge] + downstream[edge];
+    for (vector<Node*>::iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end(); ++i) {
+      Edge* in_edge = (*i)->in_edge();
+      if (!in_edge || !want_.count(in_edge))
+        continue;
+      int64_t& in_downstream = downstream[in_edge];
+      in_downstream = max(in_downstream, edge->critical_path_weight_);
+      if (--dependents[in_edge] == 0)
+        work.push_back(in_edge);
+    }
+  }
+
+  // The weights of ready and delayed edges changed underneath their queues'
+  // ordering.  Nothing has started yet, so pooled edges that were let through
+  // go back to their pools, which pick again in the new order.
+  set<Pool*> pools;
+  for (map<Edge*, bool>::iterator e = want_.begin(); e != want_.end(); ++e)
+    pools.insert(e->first->pool());
+  for (set<Pool*>::iterator p = pools.begin(); p != pools.end(); ++p)
+    (*p)->ResortDelayedEdges();
+  EdgePriorityQueue ready;
+  for (EdgePriorityQueue::iterator e = ready_.begin(); e != ready_.end(); ++e) {
+    Pool* pool = (*e)->pool();
+    if (pool->ShouldDelayEdge()) {
+      pool->EdgeFinished(**e);
+      pool->DelayEdge(*e);
+    } else {
+      ready.insert(*e);
+    }
+  }
+  for (set<Pool*>::iterator p = pools.begin(); p != pools.end(); ++p)
+    (*p)->RetrieveReadyEdges(&ready);
+  ready_.swap(ready);
+}
+
 void Plan::Dump() {
   printf("pending: %d\n", (int)want_.size());
   for (map<Edge*, bool>::iterator e = want_.begin(); e != want_.end(); ++e) {
@@ -528,7 +627,7 @@ Builder::Builder(State* state, const BuildConfig& config,
                  BuildLog* build_log, DepsLog* deps_log,
                  DiskInterface* disk_interface)
     : state_(state), config_(config), disk_interface_(disk_interface),
-      scan_(state, build_log, deps_log, disk_interface) {
+      scan_(state, build_log, deps_log, disk_interface), action_cache_(NULL) {
   status_ = new BuildStatus(config);
 }
 
@@ -597,6 +696,9 @@ bool Builder::Build(string* err) {
   assert(!AlreadyUpToDate());
 
   status_->PlanHasTotalEdges(plan_.command_edge_count());
+  if (config_.critical_path_scheduling)
+    plan_.ComputeCriticalPath(scan_.build_log());
+
   int pending_commands = 0;
   int failures_allowed = config_.failures_allowed;
 
@@ -637,8 +739,11 @@ bool Builder::Build(string* err) {
     // See if we can reap any finished commands.
     if (pending_commands) {
       CommandRunner::Result result;
-      if (!command_runner_->WaitForCommand(&result) ||
-          result.status == ExitInterrupted) {
+      if (!restored_.empty()) {
+        result = restored_.front();
+        restored_.pop_front();
+      } else if (!command_runner_->WaitForCommand(&result) ||
+                 result.status == ExitInterrupted) {
         Cleanup();
         status_->BuildFinished();
         *err = "interrupted by user";
@@ -695,6 +800,18 @@ bool Builder::StartEdge(Edge* edge, string* err) {
       return false;
   }
 
+  // An edge restored from the action cache finishes on the next trip
+  // through the main loop, without running its command.
+  if (action_cache_ && ActionCache::IsCacheable(edge)) {
+    CommandRunner::Result result;
+    if (action_cache_->Restore(edge, &result.output)) {
+      result.edge = edge;
+      result.status = ExitSuccess;
+      restored_.push_back(result);
+      return true;
+    }
+  }
+
   // Create response file, if needed
   // XXX: this may also block; do we care?
   string rspfile = edge->GetUnescapedRspfile();
@@ -726,6 +843,19 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   vector<Node*> deps_nodes;
   string deps_type = edge->GetBinding("deps");
   const string deps_prefix = edge->GetBinding("msvc_deps_prefix");
+
+  // The action cache stores what the command left behind, before deps
+  // extraction filters the output and deletes the depfile.
+  string cache_output, cache_depfile;
+  if (action_cache_ && result->success()) {
+    cache_output = result->output;
+    if (deps_type == "gcc") {
+      string read_err;
+      cache_depfile = disk_interface_->ReadFile(edge->GetUnescapedDepfile(),
+                                                &read_err);
+    }
+  }
+
   if (!deps_type.empty()) {
     string extract_err;
     if (!ExtractDeps(result, deps_type, deps_prefix, &deps_nodes,
@@ -788,6 +918,9 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
 
   plan_.EdgeFinished(edge);
 
+  if (action_cache_)
+    action_cache_->EdgeFinished(edge, cache_output, cache_depfile, deps_nodes);
+
   // Delete any left over response file.
   string rspfile = edge->GetUnescapedRspfile();
   if (!rspfile.empty() && !g_keep_rsp)
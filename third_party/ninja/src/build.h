@@ -16,6 +16,7 @@
 #define NINJA_BUILD_H_
 
 #include <cstdio>
+#include <deque>
 #include <map>
 #include <memory>
 #include <queue>
@@ -27,8 +28,10 @@
 #include "exit_status.h"
 #include "line_printer.h"
 #include "metrics.h"
+#include "state.h"  // EdgePriorityQueue
 #include "util.h"  // int64_t
 
+struct ActionCache;
 struct BuildLog;
 struct BuildStatus;
 struct DiskInterface;
@@ -66,6 +69,12 @@ struct Plan {
   /// Number of edges with commands to run.
   int command_edge_count() const { return command_edges_; }
 
+  /// Weight every edge in the plan by the length of the longest chain of
+  /// work it gates, using command durations recorded in |build_log| (which
+  /// may be NULL), so that FindWork() returns the most critical edge first.
+  /// Commands with no recorded duration are assumed to take the average time.
+  void ComputeCriticalPath(BuildLog* build_log);
+
 private:
   bool AddSubTarget(Node* node, vector<Node*>* stack, string* err);
   bool CheckDependencyCycle(Node* node, vector<Node*>* stack, string* err);
@@ -88,7 +97,7 @@ private:
   /// want to build it.
   map<Edge*, bool> want_;
 
-  set<Edge*> ready_;
+  EdgePriorityQueue ready_;
 
   /// Total number of edges that have commands (not phony).
   int command_edges_;
@@ -123,7 +132,8 @@ struct CommandRunner {
 /// Options (e.g. verbosity, parallelism) passed to a build.
 struct BuildConfig {
   BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1),
-                  failures_allowed(1), max_load_average(-0.0f) {}
+                  failures_allowed(1), max_load_average(-0.0f),
+                  critical_path_scheduling(false) {}
 
   enum Verbosity {
     NORMAL,
@@ -137,6 +147,9 @@ struct BuildConfig {
   /// The maximum load average we must not exceed. A negative value
   /// means that we do not have any limit.
   double max_load_average;
+  /// Start the edges on the longest remaining chain of work first, based on
+  /// the durations in the build log, rather than in arbitrary order.
+  bool critical_path_scheduling;
 };
 
 /// Builder wraps the build process: starting commands, updating status.
@@ -173,6 +186,12 @@ struct Builder {
     scan_.set_build_log(log);
   }
 
+  /// Look up edges in \a cache before running them, and store the outputs
+  /// of those that ran.  Off by default.
+  void SetActionCache(ActionCache* cache) {
+    action_cache_ = cache;
+  }
+
   State* state_;
   const BuildConfig& config_;
   Plan plan_;
@@ -186,6 +205,11 @@ struct Builder {
 
   DiskInterface* disk_interface_;
   DependencyScan scan_;
+  ActionCache* action_cache_;
+
+  /// Results of edges restored from the action cache, to be finished like
+  /// commands that ran.
+  deque<CommandRunner::Result> restored_;
 
   // Unimplemented copy ctor and operator= ensure we don't copy the auto_ptr.
   Builder(const Builder &other);        // DO NOT IMPLEMENT
@@ -171,125 +171,121 @@ void BuildLog::Close() {
   log_file_ = NULL;
 }
 
-struct LineReader {
-  explicit LineReader(FILE* file)
-    : file_(file), buf_end_(buf_), line_start_(buf_), line_end_(NULL) {
-      memset(buf_, 0, sizeof(buf_));
-  }
-
-  // Reads a \n-terminated line from the file passed to the constructor.
-  // On return, *line_start points to the beginning of the next line, and
-  // *line_end points to the \n at the end of the line. If no newline is seen
-  // in a fixed buffer size, *line_end is set to NULL. Returns false on EOF.
-  bool ReadLine(char** line_start, char** line_end) {
-    if (line_start_ >= buf_end_ || !line_end_) {
-      // Buffer empty, refill.
-      size_t size_read = fread(buf_, 1, sizeof(buf_), file_);
-      if (!size_read)
-        return false;
-      line_start_ = buf_;
-      buf_end_ = buf_ + size_read;
-    } else {
-      // Advance to next line in buffer.
-      line_start_ = line_end_ + 1;
-    }
+namespace {
 
-    line_end_ = (char*)memchr(line_start_, '\n', buf_end_ - line_start_);
-    if (!line_end_) {
-      // No newline. Move rest of data to start of buffer, fill rest.
-      size_t already_consumed = line_start_ - buf_;
-      size_t size_rest = (buf_end_ - buf_) - already_consumed;
-      memmove(buf_, line_start_, size_rest);
-
-      size_t read = fread(buf_ + size_rest, 1, sizeof(buf_) - size_rest, file_);
-      buf_end_ = buf_ + size_rest + read;
-      line_start_ = buf_;
-      line_end_ = (char*)memchr(line_start_, '\n', buf_end_ - line_start_);
-    }
+/// Parses a decimal integer, with optional leading '-', from [start, end).
+/// Stops at the first non-digit like atoi() does.
+int64_t ParseDecimal(const char* start, const char* end) {
+  bool negative = start < end && *start == '-';
+  if (negative)
+    ++start;
+  int64_t value = 0;
+  for (; start < end && *start >= '0' && *start <= '9'; ++start)
+    value = value * 10 + (*start - '0');
+  return negative ? -value : value;
+}
 
-    *line_start = line_start_;
-    *line_end = line_end_;
-    return true;
+/// Parses a hexadecimal integer from [start, end), like strtoull(.., 16).
+uint64_t ParseHex(const char* start, const char* end) {
+  uint64_t value = 0;
+  for (; start < end; ++start) {
+    char c = *start;
+    if (c >= '0' && c <= '9')
+      value = (value << 4) | (c - '0');
+    else if (c >= 'a' && c <= 'f')
+      value = (value << 4) | (c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      value = (value << 4) | (c - 'A' + 10);
+    else
+      break;
   }
+  return value;
+}
 
- private:
-  FILE* file_;
-  char buf_[256 << 10];
-  char* buf_end_;  // Points one past the last valid byte in |buf_|.
-
-  char* line_start_;
-  // Points at the next \n in buf_ after line_start, or NULL.
-  char* line_end_;
-};
+}  // namespace
 
 bool BuildLog::Load(const string& path, string* err) {
   METRIC_RECORD(".ninja_log load");
-  FILE* file = fopen(path.c_str(), "r");
-  if (!file) {
-    if (errno == ENOENT)
-      return true;
-    *err = strerror(errno);
-    return false;
+  // The log is parsed in place from a read-only mapping.  Only outputs seen
+  // for the first time allocate; later records for the same output just
+  // update the existing entry.
+  MappedFile file;
+  int ret = file.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return true;
   }
+  if (ret < 0)
+    return false;
+
+  const char* data = file.data();
+  const char* data_end = data + file.size();
+  if (data == data_end)
+    return true;  // file was empty
 
   int log_version = 0;
+  const char kSignaturePrefix[] = "# ninja log v";
+  const size_t kSignaturePrefixLen = sizeof(kSignaturePrefix) - 1;
+  if (file.size() > kSignaturePrefixLen &&
+      memcmp(data, kSignaturePrefix, kSignaturePrefixLen) == 0) {
+    const char* line_end = (const char*)memchr(data, '\n', data_end - data);
+    log_version = (int)ParseDecimal(data + kSignaturePrefixLen,
+                                    line_end ? line_end : data_end);
+  }
+  if (log_version < kOldestSupportedVersion) {
+    *err = ("build log version invalid, perhaps due to being too old; "
+            "starting over");
+    file.Close();
+    unlink(path.c_str());
+    // Don't report this as a failure.  An empty build log will cause
+    // us to rebuild the outputs anyway.
+    return true;
+  }
+
   int unique_entry_count = 0;
   int total_entry_count = 0;
 
-  LineReader reader(file);
-  char* line_start = 0;
-  char* line_end = 0;
-  while (reader.ReadLine(&line_start, &line_end)) {
-    if (!log_version) {
-      sscanf(line_start, kFileSignature, &log_version);
-
-      if (log_version < kOldestSupportedVersion) {
-        *err = ("build log version invalid, perhaps due to being too old; "
-                "starting over");
-        fclose(file);
-        unlink(path.c_str());
-        // Don't report this as a failure.  An empty build log will cause
-        // us to rebuild the outputs anyway.
-        return true;
-      }
-    }
-
-    // If no newline was found in this chunk, read the next.
+  const char kFieldSeparator = '\t';
+  const ptrdiff_t kMaxLineLength = 256 << 10;
+  const char* line_start = data;
+  for (;;) {
+    const char* line_end =
+        (const char*)memchr(line_start, '\n', data_end - line_start);
+    // A line without a newline is either the end of the file or a record
+    // that is still being written; ignore it.
     if (!line_end)
-      continue;
+      break;
+    const char* start = line_start;
+    line_start = line_end + 1;
 
-    const char kFieldSeparator = '\t';
+    // Overlong lines are ignored, as they were when the log was read through
+    // a fixed-size buffer.
+    if (line_end - start >= kMaxLineLength)
+      continue;
 
-    char* start = line_start;
-    char* end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    const char* end = (const char*)memchr(start, kFieldSeparator,
+                                          line_end - start);
     if (!end)
       continue;
-    *end = 0;
-
-    int start_time = 0, end_time = 0;
-    TimeStamp restat_mtime = 0;
-
-    start_time = atoi(start);
+    int start_time = (int)ParseDecimal(start, end);
     start = end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    end = (const char*)memchr(start, kFieldSeparator, line_end - start);
     if (!end)
       continue;
-    *end = 0;
-    end_time = atoi(start);
+    int end_time = (int)ParseDecimal(start, end);
     start = end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    end = (const char*)memchr(start, kFieldSeparator, line_end - start);
     if (!end)
       continue;
-    *end = 0;
-    restat_mtime = atol(start);
+    TimeStamp restat_mtime = (TimeStamp)ParseDecimal(start, end);
     start = end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
+    end = (const char*)memchr(start, kFieldSeparator, line_end - start);
     if (!end)
       continue;
-    string output = string(start, end - start);
+    StringPiece output(start, end - start);
 
     start = end + 1;
     end = line_end;
@@ -299,7 +295,7 @@ bool BuildLog::Load(const string& path, string* err) {
     if (i != entries_.end()) {
       entry = i->second;
     } else {
-      entry = new LogEntry(output);
+      entry = new LogEntry(output.AsString());
       entries_.insert(Entries::value_type(entry->output, entry));
       ++unique_entry_count;
     }
@@ -309,19 +305,12 @@ bool BuildLog::Load(const string& path, string* err) {
     entry->end_time = end_time;
     entry->restat_mtime = restat_mtime;
     if (log_version >= 5) {
-      char c = *end; *end = '\0';
-      entry->command_hash = (uint64_t)strtoull(start, NULL, 16);
-      *end = c;
+      entry->command_hash = ParseHex(start, end);
     } else {
       entry->command_hash = LogEntry::HashCommand(StringPiece(start,
                                                               end - start));
     }
   }
-  fclose(file);
-
-  if (!line_start) {
-    return true; // file was empty
-  }
 
   // Decide whether it's time to rebuild the log:
   // - if we're upgrading versions
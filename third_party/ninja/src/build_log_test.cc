@@ -215,8 +215,8 @@ TEST_F(BuildLogTest, DuplicateVersionHeader) {
 }
 
 TEST_F(BuildLogTest, VeryLongInputLine) {
-  // Ninja's build log buffer is currently 256kB. Lines longer than that are
-  // silently ignored, but don't affect parsing of other lines.
+  // Build log lines longer than 256kB are silently ignored, but don't affect
+  // parsing of other lines.
   FILE* f = fopen(kTestFilename, "wb");
   fprintf(f, "# ninja log v4\n");
   fprintf(f, "123\t456\t456\tout\tcommand start");
@@ -16,6 +16,7 @@
 
 #include <assert.h>
 
+#include "action_cache.h"
 #include "build_log.h"
 #include "deps_log.h"
 #include "graph.h"
@@ -412,6 +413,126 @@ TEST_F(PlanTest, PoolWithRedundantEdges) {
   ASSERT_FALSE(plan_.more_to_do());
 }
 
+TEST_F(PlanTest, CriticalPathWithoutLog) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build a1: cat in\n"
+"build a2: cat a1\n"
+"build a3: cat a2\n"
+"build b: cat in\n"
+"build out: cat a3 b\n"));
+  GetNode("a1")->MarkDirty();
+  GetNode("a2")->MarkDirty();
+  GetNode("a3")->MarkDirty();
+  GetNode("b")->MarkDirty();
+  GetNode("out")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  // With no recorded durations every command costs the same, so the longer
+  // chain through a1 goes first.
+  plan_.ComputeCriticalPath(NULL);
+  EXPECT_EQ(4, GetNode("a1")->in_edge()->critical_path_weight());
+  EXPECT_EQ(2, GetNode("b")->in_edge()->critical_path_weight());
+  EXPECT_EQ(1, GetNode("out")->in_edge()->critical_path_weight());
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("a1", edge->outputs_[0]->path());
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("b", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, CriticalPathFromLog) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build a1: cat in\n"
+"build a2: cat a1\n"
+"build a3: cat a2\n"
+"build b: cat in\n"
+"build c: cat in\n"
+"build out: cat a3 b c\n"
+"build all: phony out\n"));
+  BuildLog log;
+  log.RecordCommand(GetNode("a1")->in_edge(), 0, 10);
+  log.RecordCommand(GetNode("a2")->in_edge(), 10, 20);
+  log.RecordCommand(GetNode("a3")->in_edge(), 20, 30);
+  log.RecordCommand(GetNode("b")->in_edge(), 0, 100);
+  log.RecordCommand(GetNode("out")->in_edge(), 100, 105);
+
+  GetNode("a1")->MarkDirty();
+  GetNode("a2")->MarkDirty();
+  GetNode("a3")->MarkDirty();
+  GetNode("b")->MarkDirty();
+  GetNode("c")->MarkDirty();
+  GetNode("out")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  plan_.ComputeCriticalPath(&log);
+  EXPECT_EQ(0, GetNode("all")->in_edge()->critical_path_weight());
+  EXPECT_EQ(105, GetNode("b")->in_edge()->critical_path_weight());
+  EXPECT_EQ(35, GetNode("a1")->in_edge()->critical_path_weight());
+  // c has no history, so it is assumed to take the average time (27ms).
+  EXPECT_EQ(32, GetNode("c")->in_edge()->critical_path_weight());
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("b", edge->outputs_[0]->path());
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("a1", edge->outputs_[0]->path());
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("c", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, CriticalPathWithPool) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"pool link\n"
+"  depth = 1\n"
+"rule link\n"
+"  command = cat $in > $out\n"
+"  pool = link\n"
+"build short1: link in\n"
+"build short2: link in\n"
+"build long: link in\n"
+"build all: phony short1 short2 long\n"));
+  BuildLog log;
+  log.RecordCommand(GetNode("short1")->in_edge(), 0, 10);
+  log.RecordCommand(GetNode("short2")->in_edge(), 0, 10);
+  log.RecordCommand(GetNode("long")->in_edge(), 0, 100);
+
+  GetNode("short1")->MarkDirty();
+  GetNode("short2")->MarkDirty();
+  GetNode("long")->MarkDirty();
+  GetNode("all")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // The pool let an edge through before the weights were known; the long
+  // step still goes first.
+  plan_.ComputeCriticalPath(&log);
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("long", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+  plan_.EdgeFinished(edge);
+
+  for (int i = 0; i < 2; ++i) {
+    edge = plan_.FindWork();
+    ASSERT_TRUE(edge);
+    EXPECT_NE("long", edge->outputs_[0]->path());
+    ASSERT_FALSE(plan_.FindWork());
+    plan_.EdgeFinished(edge);
+  }
+}
+
 /// Fake implementation of CommandRunner, useful for tests.
 struct FakeCommandRunner : public CommandRunner {
   explicit FakeCommandRunner(VirtualFileSystem* fs) :
@@ -2059,3 +2180,111 @@ TEST_F(BuildTest, Console) {
   EXPECT_EQ("", err);
   ASSERT_EQ(1u, command_runner_.commands_ran_.size());
 }
+
+#ifndef _WIN32
+
+/// Tests of builds that restore outputs from an action cache.  The cache
+/// reads and writes real files, so these builds use the real disk too.
+struct BuildWithActionCacheTest : public BuildTest {
+  BuildWithActionCacheTest() : cache_(&disk_) {}
+
+  virtual void SetUp() {
+    BuildTest::SetUp();
+
+    temp_dir_.CreateAndEnter("BuildWithActionCacheTest");
+    string err;
+    ASSERT_TRUE(cache_.Open("cache", 1 << 20, &err));
+    ASSERT_EQ("", err);
+  }
+
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  /// Store what the command of the edge building \a output left behind,
+  /// then remove \a output so that the next build has to bring it back.
+  void Store(State* state, const string& output, const string& depfile) {
+    Edge* edge = state->GetNode(output, 0)->in_edge();
+    vector<Node*> deps;
+    deps.push_back(state->GetNode("header", 0));
+    ASSERT_TRUE(disk_.WriteFile(output, "compiled"));
+    cache_.EdgeFinished(edge, "", depfile, deps);
+    ASSERT_EQ(0, disk_.RemoveFile(output));
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_;
+  ActionCache cache_;
+
+  /// Shadow parent class builder_ so we don't accidentally use it.
+  void* builder_;
+};
+
+static const char kActionCacheManifest[] =
+"rule cc\n"
+"  command = cc $in\n"
+"  depfile = $out.d\n"
+"  deps = gcc\n"
+"build out: cc in\n";
+
+TEST_F(BuildWithActionCacheTest, Restore) {
+  State state;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kActionCacheManifest));
+  ASSERT_TRUE(disk_.WriteFile("in", ""));
+  ASSERT_TRUE(disk_.WriteFile("header", ""));
+  ASSERT_NO_FATAL_FAILURE(Store(&state, "out", "out: in header\n"));
+
+  string err;
+  DepsLog deps_log;
+  ASSERT_TRUE(deps_log.OpenForWrite("ninja_deps", &err));
+  ASSERT_EQ("", err);
+
+  Builder builder(&state, config_, NULL, &deps_log, &disk_);
+  builder.SetActionCache(&cache_);
+  builder.command_runner_.reset(&command_runner_);
+  EXPECT_TRUE(builder.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder.Build(&err));
+  EXPECT_EQ("", err);
+  builder.command_runner_.release();
+
+  // The restored edge finished without running its command, and its deps
+  // were read from the restored depfile.
+  EXPECT_EQ(0u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("compiled", disk_.ReadFile("out", &err));
+  EXPECT_EQ(0, disk_.Stat("out.d"));
+  DepsLog::Deps* deps = deps_log.GetDeps(state.GetNode("out", 0));
+  ASSERT_TRUE(deps);
+  ASSERT_EQ(2, deps->node_count);
+  EXPECT_EQ("header", deps->nodes[1]->path());
+  deps_log.Close();
+}
+
+TEST_F(BuildWithActionCacheTest, RestoredDepfileFails) {
+  State state;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state, kActionCacheManifest));
+  ASSERT_TRUE(disk_.WriteFile("in", ""));
+  ASSERT_TRUE(disk_.WriteFile("header", ""));
+  ASSERT_NO_FATAL_FAILURE(Store(&state, "out", "not a depfile\n"));
+
+  string err;
+  DepsLog deps_log;
+  ASSERT_TRUE(deps_log.OpenForWrite("ninja_deps", &err));
+  ASSERT_EQ("", err);
+
+  // A restored edge whose deps can't be extracted fails like a command.
+  Builder builder(&state, config_, NULL, &deps_log, &disk_);
+  builder.SetActionCache(&cache_);
+  builder.command_runner_.reset(&command_runner_);
+  EXPECT_TRUE(builder.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder.Build(&err));
+  EXPECT_EQ("subcommand failed", err);
+  builder.command_runner_.release();
+
+  EXPECT_EQ(0u, command_runner_.commands_ran_.size());
+  EXPECT_FALSE(deps_log.GetDeps(state.GetNode("out", 0)));
+  deps_log.Close();
+}
+
+#endif  // !_WIN32
@@ -0,0 +1,152 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Simulates building a skewed graph -- thousands of short compiles plus one
+// long chain of generator steps that gates the final link -- with and
+// without critical path scheduling, and reports the simulated wall-clock
+// time of each build.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <set>
+
+#include "build.h"
+#include "build_log.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "state.h"
+#include "util.h"
+
+const int kNumCompiles = 4000;
+const int kCompileMillis = 100;
+const int kNumGenerators = 8;
+const int kGeneratorMillis = 1500;
+const int kLinkMillis = 500;
+const int kParallelism = 64;
+
+bool LoadManifest(State* state, string* err) {
+  string manifest = "rule cxx\n  command = cxx $in -o $out\n"
+                    "rule gen\n  command = gen $in -o $out\n"
+                    "rule link\n  command = link $in -o $out\n";
+  string objs;
+  for (int i = 0; i < kNumCompiles; ++i) {
+    char buf[80];
+    sprintf(buf, "build obj%d.o: cxx src%d.cc\n", i, i);
+    manifest += buf;
+    sprintf(buf, " obj%d.o", i);
+    objs += buf;
+  }
+  // The generator chain comes last so that, in address order, it tends to be
+  // scheduled after the compiles.
+  string previous = "schema.in";
+  for (int i = 0; i < kNumGenerators; ++i) {
+    char buf[80];
+    sprintf(buf, "gen%d.out", i);
+    manifest += "build " + string(buf) + ": gen " + previous + "\n";
+    previous = buf;
+  }
+  manifest += "build app: link" + objs + " " + previous + "\n";
+
+  ManifestParser parser(state, NULL);
+  return parser.ParseTest(manifest, err);
+}
+
+int Duration(Edge* edge) {
+  const string& rule = edge->rule().name();
+  if (rule == "gen")
+    return kGeneratorMillis;
+  if (rule == "link")
+    return kLinkMillis;
+  return kCompileMillis;
+}
+
+/// Runs a simulated build of "app" at -j kParallelism and returns how many
+/// simulated milliseconds it took.
+int SimulateBuild(BuildLog* build_log, bool critical_path, string* err) {
+  State state;
+  if (!LoadManifest(&state, err))
+    return -1;
+  for (vector<Edge*>::iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    for (vector<Node*>::iterator o = (*e)->outputs_.begin();
+         o != (*e)->outputs_.end(); ++o)
+      (*o)->MarkDirty();
+  }
+
+  Plan plan;
+  if (!plan.AddTarget(state.LookupNode("app"), err))
+    return -1;
+  if (critical_path)
+    plan.ComputeCriticalPath(build_log);
+
+  int now = 0;
+  multiset<pair<int, Edge*> > running;
+  while (plan.more_to_do()) {
+    while ((int)running.size() < kParallelism) {
+      Edge* edge = plan.FindWork();
+      if (!edge)
+        break;
+      running.insert(make_pair(now + Duration(edge), edge));
+    }
+    if (running.empty()) {
+      *err = "stuck";
+      return -1;
+    }
+    now = running.begin()->first;
+    Edge* edge = running.begin()->second;
+    running.erase(running.begin());
+    plan.EdgeFinished(edge);
+  }
+  return now;
+}
+
+int main() {
+  string err;
+
+  // Record a previous build's durations, as a real build would have.
+  BuildLog build_log;
+  {
+    State state;
+    if (!LoadManifest(&state, &err)) {
+      fprintf(stderr, "Failed to parse test data: %s\n", err.c_str());
+      return 1;
+    }
+    for (vector<Edge*>::iterator e = state.edges_.begin();
+         e != state.edges_.end(); ++e)
+      build_log.RecordCommand(*e, 0, Duration(*e));
+  }
+
+  printf("%d compiles of %dms, a chain of %d %dms generators, -j%d\n",
+         kNumCompiles, kCompileMillis, kNumGenerators, kGeneratorMillis,
+         kParallelism);
+  printf("lower bound: %dms\n",
+         kNumGenerators * kGeneratorMillis + kLinkMillis);
+
+  for (int critical_path = 0; critical_path < 2; ++critical_path) {
+    int64_t start = GetTimeMillis();
+    int simulated = SimulateBuild(&build_log, critical_path, &err);
+    if (simulated < 0) {
+      fprintf(stderr, "Failed to simulate build: %s\n", err.c_str());
+      return 1;
+    }
+    int delta = (int)(GetTimeMillis() - start);
+    printf("%-16s simulated build %dms (planning took %dms)\n",
+           critical_path ? "critical path:" : "address order:",
+           simulated, delta);
+  }
+
+  return 0;
+}
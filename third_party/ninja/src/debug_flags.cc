@@ -17,3 +17,5 @@ bool g_explaining = false;
 bool g_keep_rsp = false;
 
 bool g_experimental_statcache = true;
+
+bool g_experimental_parallel_parse = false;
@@ -123,7 +123,24 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
   if (!made_change)
     return true;
 
-  // Update on-disk representation.
+  // Update on-disk representation.  Flush so that the records just written
+  // reach the file together.
+  if (!WriteDepsRecord(node, mtime, node_count, nodes))
+    return false;
+  if (fflush(file_) != 0)
+    return false;
+
+  // Update in-memory representation.
+  Deps* deps = new Deps(mtime, node_count);
+  for (int i = 0; i < node_count; ++i)
+    deps->nodes[i] = nodes[i];
+  UpdateDeps(node->id(), deps);
+
+  return true;
+}
+
+bool DepsLog::WriteDepsRecord(Node* node, TimeStamp mtime,
+                              int node_count, Node** nodes) {
   unsigned size = 4 * (1 + 1 + node_count);
   if (size > kMaxRecordSize) {
     errno = ERANGE;
@@ -143,15 +160,6 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
     if (fwrite(&id, 4, 1, file_) < 1)
       return false;
   }
-  if (fflush(file_) != 0)
-    return false;
-
-  // Update in-memory representation.
-  Deps* deps = new Deps(mtime, node_count);
-  for (int i = 0; i < node_count; ++i)
-    deps->nodes[i] = nodes[i];
-  UpdateDeps(node->id(), deps);
-
   return true;
 }
 
@@ -163,60 +171,68 @@ void DepsLog::Close() {
 
 bool DepsLog::Load(const string& path, State* state, string* err) {
   METRIC_RECORD(".ninja_deps load");
-  char buf[kMaxRecordSize + 1];
-  FILE* f = fopen(path.c_str(), "rb");
-  if (!f) {
-    if (errno == ENOENT)
-      return true;
-    *err = strerror(errno);
-    return false;
+  // Records are decoded in place from a read-only mapping of the log rather
+  // than being copied out one at a time.
+  MappedFile file;
+  int ret = file.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return true;
   }
+  if (ret < 0)
+    return false;
+
+  const char* data = file.data();
+  const char* data_end = data + file.size();
+  const size_t kHeaderSize = sizeof(kFileSignature) - 1 + 4;
 
-  bool valid_header = true;
+  bool valid_header = file.size() >= kHeaderSize;
   int version = 0;
-  if (!fgets(buf, sizeof(buf), f) || fread(&version, 4, 1, f) < 1)
-    valid_header = false;
+  if (valid_header)
+    memcpy(&version, data + sizeof(kFileSignature) - 1, 4);
   // Note: For version differences, this should migrate to the new format.
   // But the v1 format could sometimes (rarely) end up with invalid data, so
   // don't migrate v1 to v3 to force a rebuild. (v2 only existed for a few days,
   // and there was no release with it, so pretend that it never happened.)
-  if (!valid_header || strcmp(buf, kFileSignature) != 0 ||
+  if (!valid_header ||
+      memcmp(data, kFileSignature, sizeof(kFileSignature) - 1) != 0 ||
       version != kCurrentVersion) {
     if (version == 1)
       *err = "deps log version change; rebuilding";
     else
       *err = "bad deps log signature or version; starting over";
-    fclose(f);
+    file.Close();
     unlink(path.c_str());
     // Don't report this as a failure.  An empty deps log will cause
     // us to rebuild the outputs anyway.
     return true;
   }
 
-  long offset;
+  // Every record is a multiple of 4 bytes long and the header is 16 bytes,
+  // so record contents stay 4-byte aligned within the mapping.
+  const char* record = data + kHeaderSize;
   bool read_failed = false;
   int unique_dep_record_count = 0;
   int total_dep_record_count = 0;
-  for (;;) {
-    offset = ftell(f);
-
+  while (record < data_end) {
     unsigned size;
-    if (fread(&size, 4, 1, f) < 1) {
-      if (!feof(f))
-        read_failed = true;
+    if (data_end - record < 4) {
+      read_failed = true;
       break;
     }
+    memcpy(&size, record, 4);
     bool is_deps = (size >> 31) != 0;
     size = size & 0x7FFFFFFF;
 
-    if (fread(buf, size, 1, f) < 1 || size > kMaxRecordSize) {
+    const char* buf = record + 4;
+    if (size > kMaxRecordSize || (size_t)(data_end - buf) < size) {
       read_failed = true;
       break;
     }
 
     if (is_deps) {
       assert(size % 4 == 0);
-      int* deps_data = reinterpret_cast<int*>(buf);
+      const int* deps_data = reinterpret_cast<const int*>(buf);
       int out_id = deps_data[0];
       int mtime = deps_data[1];
       deps_data += 2;
@@ -251,7 +267,7 @@ bool DepsLog::Load(const string& path, State* state, string* err) {
       // happen if two ninja processes write to the same deps log concurrently.
       // (This uses unary complement to make the checksum look less like a
       // dependency record entry.)
-      unsigned checksum = *reinterpret_cast<unsigned*>(buf + size - 4);
+      unsigned checksum = *reinterpret_cast<const unsigned*>(buf + size - 4);
       int expected_id = ~checksum;
       int id = nodes_.size();
       if (id != expected_id) {
@@ -263,20 +279,22 @@ bool DepsLog::Load(const string& path, State* state, string* err) {
       node->set_id(id);
       nodes_.push_back(node);
     }
+
+    record = buf + size;
   }
 
   if (read_failed) {
     // An error occurred while loading; try to recover by truncating the
     // file to the last fully-read record.
-    if (ferror(f)) {
-      *err = strerror(ferror(f));
-    } else {
-      *err = "premature end of file";
-    }
-    fclose(f);
+    size_t offset = record - data;
+    file.Close();
+    *err = "premature end of file";
 
-    if (!Truncate(path.c_str(), offset, err))
+    string truncate_err;
+    if (!Truncate(path.c_str(), offset, &truncate_err)) {
+      *err = truncate_err;
       return false;
+    }
 
     // The truncate succeeded; we'll just report the load error as a
     // warning because the build can proceed.
@@ -284,8 +302,6 @@ bool DepsLog::Load(const string& path, State* state, string* err) {
     return true;
   }
 
-  fclose(f);
-
   // Rebuild the log if there are too many dead records.
   int kMinCompactionEntryCount = 1000;
   int kCompactionRatio = 3;
@@ -326,19 +342,30 @@ bool DepsLog::Recompact(const string& path, string* err) {
   for (vector<Node*>::iterator i = nodes_.begin(); i != nodes_.end(); ++i)
     (*i)->set_id(-1);
   
-  // Write out all deps again.
+  // Stream all live deps out again.  Unlike RecordDeps() this doesn't flush
+  // after every record (a partially written temporary file is simply thrown
+  // away) and hands each Deps to new_log instead of copying it; neither log
+  // deletes its Deps, so sharing them until the swap below is safe.
   for (int old_id = 0; old_id < (int)deps_.size(); ++old_id) {
     Deps* deps = deps_[old_id];
     if (!deps) continue;  // If nodes_[old_id] is a leaf, it has no deps.
 
-    if (!IsDepsEntryLiveFor(nodes_[old_id]))
+    Node* node = nodes_[old_id];
+    if (!IsDepsEntryLiveFor(node))
       continue;
 
-    if (!new_log.RecordDeps(nodes_[old_id], deps->mtime,
-                            deps->node_count, deps->nodes)) {
+    bool ok = node->id() >= 0 || new_log.RecordId(node);
+    for (int i = 0; ok && i < deps->node_count; ++i) {
+      if (deps->nodes[i]->id() < 0)
+        ok = new_log.RecordId(deps->nodes[i]);
+    }
+    if (!ok ||
+        !new_log.WriteDepsRecord(node, deps->mtime, deps->node_count,
+                                 deps->nodes)) {
       new_log.Close();
       return false;
     }
+    new_log.UpdateDeps(node->id(), deps);
   }
 
   new_log.Close();
@@ -402,8 +429,6 @@ bool DepsLog::RecordId(Node* node) {
   unsigned checksum = ~(unsigned)id;
   if (fwrite(&checksum, 4, 1, file_) < 1)
     return false;
-  if (fflush(file_) != 0)
-    return false;
 
   node->set_id(id);
   nodes_.push_back(node);
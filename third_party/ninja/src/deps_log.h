@@ -105,8 +105,11 @@ struct DepsLog {
   // Updates the in-memory representation.  Takes ownership of |deps|.
   // Returns true if a prior deps record was deleted.
   bool UpdateDeps(int out_id, Deps* deps);
-  // Write a node name record, assigning it an id.
+  // Write a node name record, assigning it an id.  Doesn't flush.
   bool RecordId(Node* node);
+  // Write a dependency record for |node|.  Doesn't flush.
+  bool WriteDepsRecord(Node* node, TimeStamp mtime, int node_count,
+                       Node** nodes);
 
   bool needs_recompaction_;
   bool quiet_;
@@ -0,0 +1,161 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "deps_log.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "state.h"
+#include "util.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+const char kTestFilename[] = "DepsLogPerfTest-tempfile";
+
+/*
+A large C++ project has tens of thousands of objects, each depending on a
+few hundred headers out of a similar number of headers overall.  Write deps
+for 20000 objects with 200 headers each, twice over, so that half of the
+records are dead and loading also exercises replacing old entries.
+*/
+const int kNumObjects = 20000;
+const int kNumHeaders = 20000;
+const int kDepsPerObject = 200;
+
+bool LoadManifest(State* state, string* err) {
+  string manifest = "rule cxx\n  command = cxx $in -o $out\n  deps = gcc\n";
+  for (int i = 0; i < kNumObjects; ++i) {
+    char buf[80];
+    sprintf(buf, "build obj/input%d.o: cxx src/input%d.cc\n", i, i);
+    manifest += buf;
+  }
+  ManifestParser parser(state, NULL);
+  return parser.ParseTest(manifest, err);
+}
+
+bool WriteTestData(string* err) {
+  State state;
+  if (!LoadManifest(&state, err))
+    return false;
+
+  DepsLog log;
+  if (!log.OpenForWrite(kTestFilename, err))
+    return false;
+
+  vector<Node*> headers;
+  for (int i = 0; i < kNumHeaders; ++i) {
+    char buf[80];
+    sprintf(buf, "include/some/fairly/deep/directory/header%d.h", i);
+    headers.push_back(state.GetNode(buf, 0));
+  }
+
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < kNumObjects; ++i) {
+      vector<Node*> deps;
+      for (int j = 0; j < kDepsPerObject; ++j)
+        deps.push_back(headers[(i * 7 + j * 13 + pass) % kNumHeaders]);
+      if (!log.RecordDeps(state.edges_[i]->outputs_[0], pass + 1, deps)) {
+        *err = "failed to record deps";
+        return false;
+      }
+    }
+  }
+  log.Close();
+  return true;
+}
+
+void PrintTimes(const char* what, const vector<int>& times) {
+  int min = times[0];
+  int max = times[0];
+  float total = 0;
+  for (size_t i = 0; i < times.size(); ++i) {
+    total += times[i];
+    if (times[i] < min)
+      min = times[i];
+    else if (times[i] > max)
+      max = times[i];
+  }
+
+  printf("%s: min %dms  max %dms  avg %.1fms\n",
+         what, min, max, total / times.size());
+}
+
+int main() {
+  vector<int> times;
+  string err;
+
+  if (!WriteTestData(&err)) {
+    fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
+    return 1;
+  }
+
+  struct stat st;
+  if (stat(kTestFilename, &st) == 0)
+    printf("deps log is %.1fMB\n", st.st_size / (1024.0 * 1024.0));
+
+  {
+    // Read once to warm up disk cache.
+    State state;
+    DepsLog log;
+    if (!log.Load(kTestFilename, &state, &err)) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+  }
+  const int kNumRepetitions = 5;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    State state;
+    int64_t start = GetTimeMillis();
+    DepsLog log;
+    if (!log.Load(kTestFilename, &state, &err)) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+    int delta = (int)(GetTimeMillis() - start);
+    printf("%dms\n", delta);
+    times.push_back(delta);
+  }
+  PrintTimes("load", times);
+
+  // Recompaction rewrites the file, so time a single run.
+  {
+    State state;
+    if (!LoadManifest(&state, &err)) {
+      fprintf(stderr, "Failed to parse manifest: %s\n", err.c_str());
+      return 1;
+    }
+    DepsLog log;
+    log.set_quiet(true);
+    if (!log.Load(kTestFilename, &state, &err)) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+    int64_t start = GetTimeMillis();
+    if (!log.Recompact(kTestFilename, &err)) {
+      fprintf(stderr, "Failed to recompact: %s\n", err.c_str());
+      return 1;
+    }
+    printf("recompact: %dms\n", (int)(GetTimeMillis() - start));
+  }
+
+  unlink(kTestFilename);
+
+  return 0;
+}
@@ -21,6 +21,7 @@ using namespace std;
 
 #include "eval_env.h"
 #include "timestamp.h"
+#include "util.h"  // int64_t
 
 struct BuildLog;
 struct DiskInterface;
@@ -145,7 +146,7 @@ struct Rule {
 /// An edge in the dependency graph; links between Nodes using Rules.
 struct Edge {
   Edge() : rule_(NULL), env_(NULL), outputs_ready_(false), deps_missing_(false),
-           implicit_deps_(0), order_only_deps_(0) {}
+           critical_path_weight_(0), implicit_deps_(0), order_only_deps_(0) {}
 
   /// Return true if all inputs' in-edges are ready.
   bool AllInputsReady() const;
@@ -174,10 +175,16 @@ struct Edge {
   bool outputs_ready_;
   bool deps_missing_;
 
+  /// Estimated time in milliseconds from starting this edge until every
+  /// wanted edge that depends on it has finished.  Only set by
+  /// Plan::ComputeCriticalPath; 0 otherwise.
+  int64_t critical_path_weight_;
+
   const Rule& rule() const { return *rule_; }
   Pool* pool() const { return pool_; }
   int weight() const { return 1; }
   bool outputs_ready() const { return outputs_ready_; }
+  int64_t critical_path_weight() const { return critical_path_weight_; }
 
   // There are three types of inputs.
   // 1) explicit deps, which show up as $in on the command line;
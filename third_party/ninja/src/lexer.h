@@ -89,6 +89,11 @@ struct Lexer {
   /// Construct an error message with context.
   bool Error(const string& message, string* err);
 
+  /// The start of the last token read.  Passing it back to set_last_token()
+  /// later makes Error() point at that token again.
+  const char* last_token() const { return last_token_; }
+  void set_last_token(const char* token) { last_token_ = token; }
+
 private:
   /// Skip past whitespace (called after each read token/ident/etc.).
   void EatWhitespace();
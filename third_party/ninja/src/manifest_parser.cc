@@ -16,8 +16,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
 #include <vector>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #include "graph.h"
 #include "metrics.h"
 #include "state.h"
@@ -25,11 +34,14 @@
 #include "version.h"
 
 ManifestParser::ManifestParser(State* state, FileReader* file_reader)
-  : state_(state), file_reader_(file_reader) {
+  : state_(state), file_reader_(file_reader), threads_(1) {
   env_ = &state->bindings_;
 }
 
 bool ManifestParser::Load(const string& filename, string* err, Lexer* parent) {
+  if (threads_ > 1 && !parent)
+    return LoadParallel(filename, err);
+
   METRIC_RECORD(".ninja parse");
   string contents;
   string read_err;
@@ -50,266 +62,356 @@ bool ManifestParser::Load(const string& filename, string* err, Lexer* parent) {
   return Parse(filename, contents, err);
 }
 
-bool ManifestParser::Parse(const string& filename, const string& input,
-                           string* err) {
-  lexer_.Start(filename, input);
 
-  for (;;) {
-    Lexer::Token token = lexer_.ReadToken();
-    switch (token) {
-    case Lexer::POOL:
-      if (!ParsePool(err))
-        return false;
-      break;
-    case Lexer::BUILD:
-      if (!ParseEdge(err))
-        return false;
-      break;
-    case Lexer::RULE:
-      if (!ParseRule(err))
-        return false;
-      break;
-    case Lexer::DEFAULT:
-      if (!ParseDefault(err))
-        return false;
-      break;
-    case Lexer::IDENT: {
-      lexer_.UnreadToken();
-      string name;
-      EvalString let_value;
-      if (!ParseLet(&name, &let_value, err))
-        return false;
-      string value = let_value.Evaluate(env_);
-      // Check ninja_required_version immediately so we can exit
-      // before encountering any syntactic surprises.
-      if (name == "ninja_required_version")
-        CheckNinjaVersion(value);
-      env_->AddBinding(name, value);
-      break;
-    }
-    case Lexer::INCLUDE:
-      if (!ParseFileInclude(false, err))
-        return false;
-      break;
-    case Lexer::SUBNINJA:
-      if (!ParseFileInclude(true, err))
-        return false;
-      break;
-    case Lexer::ERROR: {
-      return lexer_.Error(lexer_.DescribeLastError(), err);
-    }
-    case Lexer::TEOF:
-      return true;
-    case Lexer::NEWLINE:
-      break;
-    default:
-      return lexer_.Error(string("unexpected ") + Lexer::TokenName(token),
-                          err);
-    }
+// Parsing happens one statement at a time, in two steps.  LexStatement()
+// reads a statement and checks its syntax.  It depends on nothing but the
+// file's contents, so the parallel loader below runs it on worker threads.
+// ApplyStatement() then evaluates the statement and adds it to the State.
+// Errors found while applying are reported at the token the statement
+// recorded for them.  A statement that fails to lex keeps what was read
+// before the error, and ApplyStatement() first does what comes before that
+// point (e.g. checking for an unknown rule or a duplicate pool, or loading
+// an included file), so errors are reported in the order they appear in
+// the file.
+
+namespace {
+
+/// A 'key = value' line belonging to a pool, rule or edge.
+struct ParsedLet {
+  ParsedLet() : pos(NULL) {}
+  string key;
+  EvalString value;
+  /// Where errors about this binding are reported; NULL if the binding
+  /// wasn't read completely.
+  const char* pos;
+};
+
+bool ExpectToken(Lexer* lexer, Lexer::Token expected, string* err) {
+  Lexer::Token token = lexer->ReadToken();
+  if (token != expected) {
+    string message = string("expected ") + Lexer::TokenName(expected);
+    message += string(", got ") + Lexer::TokenName(token);
+    message += Lexer::TokenErrorHint(expected);
+    return lexer->Error(message, err);
   }
-  return false;  // not reached
+  return true;
 }
 
+bool ErrorAt(Lexer* lexer, const char* pos, const string& message,
+             string* err) {
+  lexer->set_last_token(pos);
+  return lexer->Error(message, err);
+}
 
-bool ManifestParser::ParsePool(string* err) {
+}  // anonymous namespace
+
+/// One top-level statement of a .ninja file, as read by LexStatement().
+struct ManifestParser::Statement {
+  Statement()
+      : type(Lexer::ERROR), complete(false), implicit(0), order_only(0),
+        pos(NULL), end(NULL) {}
+
+  /// POOL, RULE, BUILD, DEFAULT, INCLUDE, SUBNINJA, or IDENT for a
+  /// top-level 'key = value' line.
+  Lexer::Token type;
+  /// Whether the whole statement was read.  If not, it holds what was read
+  /// before the error.
+  bool complete;
+  /// The pool, rule or variable name, or the rule of an edge.
   string name;
-  if (!lexer_.ReadIdent(&name))
-    return lexer_.Error("expected pool name", err);
-
-  if (!ExpectToken(Lexer::NEWLINE, err))
+  /// The value of a variable, or the path of an 'include' or 'subninja'.
+  EvalString value;
+  vector<ParsedLet> lets;
+  /// Edge outputs and inputs, or the targets of a 'default' statement.
+  vector<EvalString> outs;
+  vector<EvalString> ins;
+  /// Where errors about each 'default' target are reported.
+  vector<const char*> positions;
+  int implicit;
+  int order_only;
+  /// Where errors about the statement's name or path are reported.
+  const char* pos;
+  /// Where errors about the statement as a whole are reported.
+  const char* end;
+};
+
+namespace {
+
+bool LexLet(Lexer* lexer, string* key, EvalString* value, string* err) {
+  if (!lexer->ReadIdent(key))
+    return lexer->Error("expected variable name", err);
+  if (!ExpectToken(lexer, Lexer::EQUALS, err))
     return false;
+  if (!lexer->ReadVarValue(value, err))
+    return false;
+  return true;
+}
 
-  if (state_->LookupPool(name) != NULL)
-    return lexer_.Error("duplicate pool '" + name + "'", err);
-
-  int depth = -1;
-
-  while (lexer_.PeekToken(Lexer::INDENT)) {
-    string key;
-    EvalString value;
-    if (!ParseLet(&key, &value, err))
+/// Read the indented bindings of a pool, rule or edge.
+bool LexLets(Lexer* lexer, vector<ParsedLet>* lets, string* err) {
+  while (lexer->PeekToken(Lexer::INDENT)) {
+    lets->push_back(ParsedLet());
+    ParsedLet* let = &lets->back();
+    if (!LexLet(lexer, &let->key, &let->value, err))
       return false;
-
-    if (key == "depth") {
-      string depth_string = value.Evaluate(env_);
-      depth = atol(depth_string.c_str());
-      if (depth < 0)
-        return lexer_.Error("invalid pool depth", err);
-    } else {
-      return lexer_.Error("unexpected variable '" + key + "'", err);
-    }
+    let->pos = lexer->last_token();
   }
-
-  if (depth < 0)
-    return lexer_.Error("expected 'depth =' line", err);
-
-  state_->AddPool(new Pool(name, depth));
   return true;
 }
 
-
-bool ManifestParser::ParseRule(string* err) {
-  string name;
-  if (!lexer_.ReadIdent(&name))
-    return lexer_.Error("expected rule name", err);
-
-  if (!ExpectToken(Lexer::NEWLINE, err))
-    return false;
-
-  if (state_->LookupRule(name) != NULL)
-    return lexer_.Error("duplicate rule '" + name + "'", err);
-
-  Rule* rule = new Rule(name);  // XXX scoped_ptr
-
-  while (lexer_.PeekToken(Lexer::INDENT)) {
-    string key;
-    EvalString value;
-    if (!ParseLet(&key, &value, err))
+/// Read paths into \a paths until an empty one, noting where each is in
+/// \a positions if given.
+bool LexPaths(Lexer* lexer, vector<EvalString>* paths,
+              vector<const char*>* positions, string* err) {
+  for (;;) {
+    paths->push_back(EvalString());
+    if (!lexer->ReadPath(&paths->back(), err))
       return false;
+    if (paths->back().empty()) {
+      paths->pop_back();
+      return true;
+    }
+    if (positions)
+      positions->push_back(lexer->last_token());
+  }
+}
 
-    if (Rule::IsReservedBinding(key)) {
-      rule->AddBinding(key, value);
-    } else {
+}  // anonymous namespace
+
+bool ManifestParser::LexStatement(Lexer* lexer, Lexer::Token token,
+                                  Statement* st, string* err) {
+  st->type = token;
+  switch (token) {
+  case Lexer::POOL:
+  case Lexer::RULE:
+    if (!lexer->ReadIdent(&st->name)) {
+      return lexer->Error(token == Lexer::POOL ? "expected pool name" :
+                          "expected rule name", err);
+    }
+    if (!ExpectToken(lexer, Lexer::NEWLINE, err))
+      return false;
+    st->pos = lexer->last_token();
+    while (lexer->PeekToken(Lexer::INDENT)) {
+      st->lets.push_back(ParsedLet());
+      ParsedLet* let = &st->lets.back();
+      if (!LexLet(lexer, &let->key, &let->value, err))
+        return false;
       // Die on other keyvals for now; revisit if we want to add a
       // scope here.
-      return lexer_.Error("unexpected variable '" + key + "'", err);
+      if (token == Lexer::POOL ? let->key != "depth" :
+                                 !Rule::IsReservedBinding(let->key)) {
+        return lexer->Error("unexpected variable '" + let->key + "'", err);
+      }
+      let->pos = lexer->last_token();
     }
-  }
+    st->end = lexer->last_token();
+    st->complete = true;
+    return true;
 
-  if (rule->bindings_["rspfile"].empty() !=
-      rule->bindings_["rspfile_content"].empty()) {
-    return lexer_.Error("rspfile and rspfile_content need to be "
-                        "both specified", err);
-  }
-
-  if (rule->bindings_["command"].empty())
-    return lexer_.Error("expected 'command =' line", err);
-
-  state_->AddRule(rule);
-  return true;
-}
-
-bool ManifestParser::ParseLet(string* key, EvalString* value, string* err) {
-  if (!lexer_.ReadIdent(key))
-    return lexer_.Error("expected variable name", err);
-  if (!ExpectToken(Lexer::EQUALS, err))
-    return false;
-  if (!lexer_.ReadVarValue(value, err))
-    return false;
-  return true;
-}
+  case Lexer::BUILD: {
+    if (!LexPaths(lexer, &st->outs, NULL, err))
+      return false;
+    if (st->outs.empty())
+      return lexer->Error("expected path", err);
+    if (!ExpectToken(lexer, Lexer::COLON, err))
+      return false;
+    if (!lexer->ReadIdent(&st->name))
+      return lexer->Error("expected build command name", err);
+    st->pos = lexer->last_token();
 
-bool ManifestParser::ParseDefault(string* err) {
-  EvalString eval;
-  if (!lexer_.ReadPath(&eval, err))
-    return false;
-  if (eval.empty())
-    return lexer_.Error("expected target name", err);
+    // XXX should we require one path here?
+    if (!LexPaths(lexer, &st->ins, NULL, err))
+      return false;
 
-  do {
-    string path = eval.Evaluate(env_);
-    string path_err;
-    unsigned int slash_bits;  // Unused because this only does lookup.
-    if (!CanonicalizePath(&path, &slash_bits, &path_err))
-      return lexer_.Error(path_err, err);
-    if (!state_->AddDefault(path, &path_err))
-      return lexer_.Error(path_err, err);
+    // Add all implicit deps, counting how many as we go.
+    size_t explicit_ins = st->ins.size();
+    if (lexer->PeekToken(Lexer::PIPE) &&
+        !LexPaths(lexer, &st->ins, NULL, err))
+      return false;
+    st->implicit = (int)(st->ins.size() - explicit_ins);
 
-    eval.Clear();
-    if (!lexer_.ReadPath(&eval, err))
+    // Add all order-only deps, counting how many as we go.
+    size_t other_ins = st->ins.size();
+    if (lexer->PeekToken(Lexer::PIPE2) &&
+        !LexPaths(lexer, &st->ins, NULL, err))
       return false;
-  } while (!eval.empty());
+    st->order_only = (int)(st->ins.size() - other_ins);
 
-  if (!ExpectToken(Lexer::NEWLINE, err))
-    return false;
+    if (!ExpectToken(lexer, Lexer::NEWLINE, err))
+      return false;
+    if (!LexLets(lexer, &st->lets, err))
+      return false;
+    st->end = lexer->last_token();
+    st->complete = true;
+    return true;
+  }
 
-  return true;
-}
+  case Lexer::DEFAULT:
+    if (!LexPaths(lexer, &st->ins, &st->positions, err))
+      return false;
+    if (st->ins.empty())
+      return lexer->Error("expected target name", err);
+    break;
 
-bool ManifestParser::ParseEdge(string* err) {
-  vector<EvalString> ins, outs;
+  case Lexer::IDENT:
+    lexer->UnreadToken();
+    if (!LexLet(lexer, &st->name, &st->value, err))
+      return false;
+    st->complete = true;
+    return true;
 
-  {
-    EvalString out;
-    if (!lexer_.ReadPath(&out, err))
+  case Lexer::INCLUDE:
+  case Lexer::SUBNINJA:
+    if (!lexer->ReadPath(&st->value, err))
       return false;
-    if (out.empty())
-      return lexer_.Error("expected path", err);
+    st->pos = lexer->last_token();
+    break;
 
-    do {
-      outs.push_back(out);
+  case Lexer::ERROR:
+    return lexer->Error(lexer->DescribeLastError(), err);
 
-      out.Clear();
-      if (!lexer_.ReadPath(&out, err))
-        return false;
-    } while (!out.empty());
+  default:
+    return lexer->Error(string("unexpected ") + Lexer::TokenName(token), err);
   }
 
-  if (!ExpectToken(Lexer::COLON, err))
+  if (!ExpectToken(lexer, Lexer::NEWLINE, err))
     return false;
+  st->complete = true;
+  return true;
+}
 
-  string rule_name;
-  if (!lexer_.ReadIdent(&rule_name))
-    return lexer_.Error("expected build command name", err);
-
-  const Rule* rule = state_->LookupRule(rule_name);
-  if (!rule)
-    return lexer_.Error("unknown build rule '" + rule_name + "'", err);
+bool ManifestParser::Parse(const string& filename, const string& input,
+                           string* err) {
+  lexer_.Start(filename, input);
 
   for (;;) {
-    // XXX should we require one path here?
-    EvalString in;
-    if (!lexer_.ReadPath(&in, err))
+    Lexer::Token token = lexer_.ReadToken();
+    if (token == Lexer::TEOF)
+      return true;
+    if (token == Lexer::NEWLINE)
+      continue;
+    Statement st;
+    string lex_err;
+    if (!LexStatement(&lexer_, token, &st, &lex_err)) {
+      // Report an earlier error in the statement's lexed part first.
+      if (ApplyStatement(st, NULL, err))
+        *err = lex_err;
+      return false;
+    }
+    if (!ApplyStatement(st, NULL, err))
       return false;
-    if (in.empty())
-      break;
-    ins.push_back(in);
   }
+}
 
-  // Add all implicit deps, counting how many as we go.
-  int implicit = 0;
-  if (lexer_.PeekToken(Lexer::PIPE)) {
-    for (;;) {
-      EvalString in;
-      if (!lexer_.ReadPath(&in, err))
-        return err;
-      if (in.empty())
-        break;
-      ins.push_back(in);
-      ++implicit;
+bool ManifestParser::ApplyStatement(const Statement& st,
+                                    Prefetcher* prefetcher, string* err) {
+  switch (st.type) {
+  case Lexer::POOL: {
+    if (!st.pos)
+      return true;
+    if (state_->LookupPool(st.name) != NULL)
+      return ErrorAt(&lexer_, st.pos, "duplicate pool '" + st.name + "'", err);
+    int depth = -1;
+    for (vector<ParsedLet>::const_iterator i = st.lets.begin();
+         i != st.lets.end() && i->pos; ++i) {
+      string depth_string = i->value.Evaluate(env_);
+      depth = atol(depth_string.c_str());
+      if (depth < 0)
+        return ErrorAt(&lexer_, i->pos, "invalid pool depth", err);
     }
+    if (!st.complete)
+      return true;
+    if (depth < 0)
+      return ErrorAt(&lexer_, st.end, "expected 'depth =' line", err);
+    state_->AddPool(new Pool(st.name, depth));
+    return true;
   }
 
-  // Add all order-only deps, counting how many as we go.
-  int order_only = 0;
-  if (lexer_.PeekToken(Lexer::PIPE2)) {
-    for (;;) {
-      EvalString in;
-      if (!lexer_.ReadPath(&in, err))
-        return false;
-      if (in.empty())
-        break;
-      ins.push_back(in);
-      ++order_only;
+  case Lexer::RULE: {
+    if (!st.pos)
+      return true;
+    if (state_->LookupRule(st.name) != NULL)
+      return ErrorAt(&lexer_, st.pos, "duplicate rule '" + st.name + "'", err);
+    if (!st.complete)
+      return true;
+    Rule* rule = new Rule(st.name);  // XXX scoped_ptr
+    for (vector<ParsedLet>::const_iterator i = st.lets.begin();
+         i != st.lets.end(); ++i) {
+      rule->AddBinding(i->key, i->value);
+    }
+    if (rule->bindings_["rspfile"].empty() !=
+        rule->bindings_["rspfile_content"].empty()) {
+      return ErrorAt(&lexer_, st.end, "rspfile and rspfile_content need to be "
+                     "both specified", err);
     }
+    if (rule->bindings_["command"].empty())
+      return ErrorAt(&lexer_, st.end, "expected 'command =' line", err);
+    state_->AddRule(rule);
+    return true;
   }
 
-  if (!ExpectToken(Lexer::NEWLINE, err))
-    return false;
+  case Lexer::BUILD: {
+    if (!st.pos)
+      return true;
+    const Rule* rule = state_->LookupRule(st.name);
+    if (!rule) {
+      return ErrorAt(&lexer_, st.pos, "unknown build rule '" + st.name + "'",
+                     err);
+    }
+    if (!st.complete)
+      return true;
+    // Bindings on edges are rare, so allocate per-edge envs only when needed.
+    BindingEnv* env = st.lets.empty() ? env_ : new BindingEnv(env_);
+    for (vector<ParsedLet>::const_iterator i = st.lets.begin();
+         i != st.lets.end(); ++i) {
+      env->AddBinding(i->key, i->value.Evaluate(env_));
+    }
+    lexer_.set_last_token(st.end);
+    return AddEdge(rule, env, st.ins, st.outs, st.implicit, st.order_only,
+                   err);
+  }
 
-  // Bindings on edges are rare, so allocate per-edge envs only when needed.
-  bool hasIdent = lexer_.PeekToken(Lexer::INDENT);
-  BindingEnv* env = hasIdent ? new BindingEnv(env_) : env_;
-  while (hasIdent) {
-    string key;
-    EvalString val;
-    if (!ParseLet(&key, &val, err))
-      return false;
+  case Lexer::DEFAULT:
+    for (size_t i = 0; i < st.positions.size(); ++i) {
+      string path = st.ins[i].Evaluate(env_);
+      string path_err;
+      unsigned int slash_bits;  // Unused because this only does lookup.
+      if (!CanonicalizePath(&path, &slash_bits, &path_err) ||
+          !state_->AddDefault(path, &path_err))
+        return ErrorAt(&lexer_, st.positions[i], path_err, err);
+    }
+    return true;
+
+  case Lexer::IDENT: {
+    if (!st.complete)
+      return true;
+    string value = st.value.Evaluate(env_);
+    // Check ninja_required_version immediately so we can exit
+    // before encountering any syntactic surprises.
+    if (st.name == "ninja_required_version")
+      CheckNinjaVersion(value);
+    env_->AddBinding(st.name, value);
+    return true;
+  }
+
+  case Lexer::INCLUDE:
+  case Lexer::SUBNINJA:
+    // The file is loaded before the end of the line is checked.
+    if (!st.pos)
+      return true;
+    lexer_.set_last_token(st.pos);
+    return LoadInclude(st.value.Evaluate(env_), st.type == Lexer::SUBNINJA,
+                       prefetcher, err);
 
-    env->AddBinding(key, val.Evaluate(env_));
-    hasIdent = lexer_.PeekToken(Lexer::INDENT);
+  default:
+    return true;
   }
+}
 
+bool ManifestParser::AddEdge(const Rule* rule, BindingEnv* env,
+                             const vector<EvalString>& ins,
+                             const vector<EvalString>& outs,
+                             int implicit, int order_only, string* err) {
   Edge* edge = state_->AddEdge(rule);
   edge->env_ = env;
 
@@ -321,7 +423,8 @@ bool ManifestParser::ParseEdge(string* err) {
     edge->pool_ = pool;
   }
 
-  for (vector<EvalString>::iterator i = ins.begin(); i != ins.end(); ++i) {
+  for (vector<EvalString>::const_iterator i = ins.begin(); i != ins.end();
+       ++i) {
     string path = i->Evaluate(env);
     string path_err;
     unsigned int slash_bits;
@@ -329,7 +432,8 @@ bool ManifestParser::ParseEdge(string* err) {
       return lexer_.Error(path_err, err);
     state_->AddIn(edge, path, slash_bits);
   }
-  for (vector<EvalString>::iterator i = outs.begin(); i != outs.end(); ++i) {
+  for (vector<EvalString>::const_iterator i = outs.begin(); i != outs.end();
+       ++i) {
     string path = i->Evaluate(env);
     string path_err;
     unsigned int slash_bits;
@@ -351,12 +455,330 @@ bool ManifestParser::ParseEdge(string* err) {
   return true;
 }
 
-bool ManifestParser::ParseFileInclude(bool new_scope, string* err) {
-  EvalString eval;
-  if (!lexer_.ReadPath(&eval, err))
+// Parallel loading.  Large builds split their manifest into hundreds of
+// subninja files, and lexing them is most of the cost of loading.  Worker
+// threads lex the files that are about to be included into lists of
+// statements while the main thread applies the statements of earlier files
+// to the State, in the same order as the serial parser would.  Both use
+// LexStatement() and ApplyStatement(), so the result and any error are the
+// same as when loading serially.
+
+/// The contents of a .ninja file and the statements lexed from it.
+struct ManifestParser::ParsedFile {
+  explicit ParsedFile(const string& filename)
+      : filename(filename), read(false), ok(false) {}
+
+  /// Read and lex the file.  Touches nothing but \a file_reader and this
+  /// object, so this can run on any thread.
+  void Lex(FileReader* file_reader);
+
+  string filename;
+  string contents;
+  /// Whether the file could be read.
+  bool read;
+  /// Whether the whole file was lexed.  If not, \a statements holds the
+  /// statements before the error and, last, the incomplete statement.
+  bool ok;
+  /// The read or lex error.
+  string error;
+  /// A deque, so that appending doesn't copy the statements before.
+  deque<Statement> statements;
+};
+
+void ManifestParser::ParsedFile::Lex(FileReader* file_reader) {
+  if (!file_reader->ReadFile(filename, &contents, &error))
+    return;
+  read = true;
+  // The lexer needs a nul byte at the end of its input; see Load().
+  contents.resize(contents.size() + 1);
+
+  Lexer lexer;
+  lexer.Start(filename, contents);
+  for (;;) {
+    Lexer::Token token = lexer.ReadToken();
+    if (token == Lexer::TEOF) {
+      ok = true;
+      return;
+    }
+    if (token == Lexer::NEWLINE)
+      continue;
+    statements.push_back(Statement());
+    if (!LexStatement(&lexer, token, &statements.back(), &error))
+      return;
+  }
+}
+
+/// Lexes files on worker threads ahead of the main thread needing them.
+struct ManifestParser::Prefetcher {
+  Prefetcher(FileReader* file_reader, int threads);
+  ~Prefetcher();
+
+  /// Queue the files \a file includes, as far as can be told by evaluating
+  /// their paths in \a env and \a file's own top-level bindings, to be lexed
+  /// before anything queued earlier.  Included files don't see bindings
+  /// made by 'include'd files, so this may guess a path wrong; Take() then
+  /// lexes the right file itself.  \a queued gets the path queued for each
+  /// 'include' and 'subninja' statement in order, or "" where none was.
+  void Prefetch(const ParsedFile& file, BindingEnv* env,
+                vector<string>* queued);
+
+  /// Return \a filename lexed, waiting for the worker lexing it or lexing it
+  /// on this thread if no worker has started on it.  The caller owns the
+  /// result.
+  ParsedFile* Take(const string& filename);
+
+  /// Drop \a filename if it was queued and hasn't been taken, so that files
+  /// queued under a wrongly guessed path don't keep counting as lexed ahead.
+  void Discard(const string& filename);
+
+ private:
+  struct Job {
+    enum State { kQueued, kRunning, kDone };
+    explicit Job(const string& filename)
+        : file(new ParsedFile(filename)), state(kQueued), discarded(false) {}
+    ~Job() { delete file; }
+    ParsedFile* file;
+    State state;
+    /// Set on a running job that was discarded; its worker deletes it.
+    bool discarded;
+  };
+
+  FileReader* file_reader_;
+  /// Jobs that haven't been taken or discarded, by filename.
+  map<string, Job*> jobs_;
+  /// Jobs that no worker has started on yet.
+  deque<Job*> queue_;
+
+#ifndef _WIN32
+  static void* Run(void* prefetcher);
+  void Work();
+
+  /// Number of jobs done but not taken or discarded.  Workers stop lexing
+  /// when this reaches max_done_, to bound the memory used by running ahead.
+  int done_;
+  int max_done_;
+  bool quit_;
+  vector<pthread_t> threads_;
+  pthread_mutex_t mutex_;
+  /// Signalled when a job finishes, a job is queued or taken, or on quit.
+  pthread_cond_t cond_;
+#endif
+};
+
+#ifdef _WIN32
+
+// No worker threads; Take() lexes every file itself.
+
+ManifestParser::Prefetcher::Prefetcher(FileReader* file_reader, int threads)
+    : file_reader_(file_reader) {}
+
+ManifestParser::Prefetcher::~Prefetcher() {}
+
+void ManifestParser::Prefetcher::Prefetch(const ParsedFile& file,
+                                          BindingEnv* env,
+                                          vector<string>* queued) {}
+
+ManifestParser::ParsedFile* ManifestParser::Prefetcher::Take(
+    const string& filename) {
+  ParsedFile* file = new ParsedFile(filename);
+  file->Lex(file_reader_);
+  return file;
+}
+
+void ManifestParser::Prefetcher::Discard(const string& filename) {}
+
+#else  // !_WIN32
+
+ManifestParser::Prefetcher::Prefetcher(FileReader* file_reader, int threads)
+    : file_reader_(file_reader), done_(0), max_done_(4 * threads),
+      quit_(false) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&cond_, NULL);
+  // The main thread lexes too, when it gets ahead of the workers.
+  for (int i = 0; i < threads - 1; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &Run, this) != 0)
+      break;
+    threads_.push_back(thread);
+  }
+}
+
+ManifestParser::Prefetcher::~Prefetcher() {
+  pthread_mutex_lock(&mutex_);
+  quit_ = true;
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+  for (vector<pthread_t>::iterator i = threads_.begin(); i != threads_.end();
+       ++i) {
+    pthread_join(*i, NULL);
+  }
+  for (map<string, Job*>::iterator i = jobs_.begin(); i != jobs_.end(); ++i)
+    delete i->second;
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void* ManifestParser::Prefetcher::Run(void* prefetcher) {
+  static_cast<Prefetcher*>(prefetcher)->Work();
+  return NULL;
+}
+
+void ManifestParser::Prefetcher::Work() {
+  pthread_mutex_lock(&mutex_);
+  for (;;) {
+    while (!quit_ && (queue_.empty() || done_ >= max_done_))
+      pthread_cond_wait(&cond_, &mutex_);
+    if (quit_)
+      break;
+    Job* job = queue_.front();
+    queue_.pop_front();
+    job->state = Job::kRunning;
+    pthread_mutex_unlock(&mutex_);
+
+    job->file->Lex(file_reader_);
+
+    pthread_mutex_lock(&mutex_);
+    if (job->discarded) {
+      delete job;
+      continue;
+    }
+    job->state = Job::kDone;
+    ++done_;
+    pthread_cond_broadcast(&cond_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void ManifestParser::Prefetcher::Prefetch(const ParsedFile& file,
+                                          BindingEnv* env,
+                                          vector<string>* queued) {
+  if (threads_.empty())
+    return;
+
+  BindingEnv scope(env);
+  for (deque<Statement>::const_iterator st = file.statements.begin();
+       st != file.statements.end() && st->complete; ++st) {
+    if (st->type == Lexer::IDENT)
+      scope.AddBinding(st->name, st->value.Evaluate(&scope));
+    else if (st->type == Lexer::INCLUDE || st->type == Lexer::SUBNINJA)
+      queued->push_back(st->value.Evaluate(&scope));
+  }
+  if (queued->empty())
+    return;
+
+  pthread_mutex_lock(&mutex_);
+  for (vector<string>::reverse_iterator i = queued->rbegin();
+       i != queued->rend(); ++i) {
+    // A file included twice is lexed once ahead; Take() lexes it again.
+    // Whoever queued it first discards it.
+    if (jobs_.count(*i)) {
+      i->clear();
+      continue;
+    }
+    Job* job = new Job(*i);
+    jobs_[*i] = job;
+    queue_.push_front(job);
+  }
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+ManifestParser::ParsedFile* ManifestParser::Prefetcher::Take(
+    const string& filename) {
+  pthread_mutex_lock(&mutex_);
+  map<string, Job*>::iterator i = jobs_.find(filename);
+  if (i == jobs_.end()) {
+    pthread_mutex_unlock(&mutex_);
+    ParsedFile* file = new ParsedFile(filename);
+    file->Lex(file_reader_);
+    return file;
+  }
+
+  Job* job = i->second;
+  jobs_.erase(i);
+  if (job->state == Job::kQueued) {
+    queue_.erase(find(queue_.begin(), queue_.end(), job));
+    pthread_mutex_unlock(&mutex_);
+    job->file->Lex(file_reader_);
+  } else {
+    while (job->state != Job::kDone)
+      pthread_cond_wait(&cond_, &mutex_);
+    --done_;
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  ParsedFile* file = job->file;
+  job->file = NULL;
+  delete job;
+  return file;
+}
+
+void ManifestParser::Prefetcher::Discard(const string& filename) {
+  pthread_mutex_lock(&mutex_);
+  map<string, Job*>::iterator i = jobs_.find(filename);
+  if (i != jobs_.end()) {
+    Job* job = i->second;
+    jobs_.erase(i);
+    if (job->state == Job::kQueued) {
+      queue_.erase(find(queue_.begin(), queue_.end(), job));
+      delete job;
+    } else if (job->state == Job::kRunning) {
+      job->discarded = true;
+    } else {
+      --done_;
+      pthread_cond_broadcast(&cond_);
+      delete job;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+#endif  // _WIN32
+
+
+bool ManifestParser::LoadParallel(const string& filename, string* err) {
+  METRIC_RECORD(".ninja parse");
+  Prefetcher prefetcher(file_reader_, threads_);
+  auto_ptr<ParsedFile> file(prefetcher.Take(filename));
+  if (!file->read) {
+    *err = "loading '" + filename + "': " + file->error;
     return false;
-  string path = eval.Evaluate(env_);
+  }
+  return Apply(file.get(), &prefetcher, err);
+}
+
+bool ManifestParser::Apply(ParsedFile* file, Prefetcher* prefetcher,
+                           string* err) {
+  // Statements keep pointers into the file's contents for error reporting.
+  lexer_.Start(file->filename, file->contents);
+  vector<string> queued;
+  prefetcher->Prefetch(*file, env_, &queued);
+
+  bool success = true;
+  size_t include = 0;
+  for (deque<Statement>::const_iterator st = file->statements.begin();
+       st != file->statements.end(); ++st) {
+    success = ApplyStatement(*st, prefetcher, err);
+    if (!success)
+      break;
+    // If the path was guessed right the file has been taken by now.
+    if ((st->type == Lexer::INCLUDE || st->type == Lexer::SUBNINJA) &&
+        st->complete && include < queued.size())
+      prefetcher->Discard(queued[include++]);
+  }
+  if (success && !file->ok) {
+    *err = file->error;
+    success = false;
+  }
+
+  for (; include < queued.size(); ++include)
+    prefetcher->Discard(queued[include]);
+  return success;
+}
 
+bool ManifestParser::LoadInclude(const string& path, bool new_scope,
+                                 Prefetcher* prefetcher, string* err) {
   ManifestParser subparser(state_, file_reader_);
   if (new_scope) {
     subparser.env_ = new BindingEnv(env_);
@@ -364,22 +786,13 @@ bool ManifestParser::ParseFileInclude(bool new_scope, string* err) {
     subparser.env_ = env_;
   }
 
-  if (!subparser.Load(path, err, &lexer_))
-    return false;
-
-  if (!ExpectToken(Lexer::NEWLINE, err))
-    return false;
-
-  return true;
-}
+  if (!prefetcher)
+    return subparser.Load(path, err, &lexer_);
 
-bool ManifestParser::ExpectToken(Lexer::Token expected, string* err) {
-  Lexer::Token token = lexer_.ReadToken();
-  if (token != expected) {
-    string message = string("expected ") + Lexer::TokenName(expected);
-    message += string(", got ") + Lexer::TokenName(token);
-    message += Lexer::TokenErrorHint(expected);
-    return lexer_.Error(message, err);
+  auto_ptr<ParsedFile> file(prefetcher->Take(path));
+  if (!file->read) {
+    *err = "loading '" + path + "': " + file->error;
+    return lexer_.Error(string(*err), err);
   }
-  return true;
+  return subparser.Apply(file.get(), prefetcher, err);
 }
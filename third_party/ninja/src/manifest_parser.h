@@ -16,6 +16,7 @@
 #define NINJA_MANIFEST_PARSER_H_
 
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -23,6 +24,7 @@ using namespace std;
 
 struct BindingEnv;
 struct EvalString;
+struct Rule;
 struct State;
 
 /// Parses .ninja files.
@@ -34,6 +36,13 @@ struct ManifestParser {
 
   ManifestParser(State* state, FileReader* file_reader);
 
+  /// Lex the files pulled in by 'subninja' and 'include' on up to \a threads
+  /// threads while earlier files are still being applied to the State.
+  /// Statements are still applied in file order, so the result (and any
+  /// error) is the same as with one thread.  The FileReader must then be
+  /// safe to call from several threads at once.
+  void set_threads(int threads) { threads_ = threads; }
+
   /// Load and parse a file.
   bool Load(const string& filename, string* err, Lexer* parent=NULL);
 
@@ -43,27 +52,45 @@ struct ManifestParser {
   }
 
 private:
+  struct Statement;
+  struct ParsedFile;
+  struct Prefetcher;
+
+  /// Load \a filename, lexing the files it includes on other threads.
+  bool LoadParallel(const string& filename, string* err);
+
+  /// Add the statements of a file lexed by a Prefetcher to the State.
+  bool Apply(ParsedFile* file, Prefetcher* prefetcher, string* err);
+
   /// Parse a file, given its contents as a string.
   bool Parse(const string& filename, const string& input, string* err);
 
-  /// Parse various statement types.
-  bool ParsePool(string* err);
-  bool ParseRule(string* err);
-  bool ParseLet(string* key, EvalString* val, string* err);
-  bool ParseEdge(string* err);
-  bool ParseDefault(string* err);
+  /// Read the statement starting with \a token into \a st, checking only
+  /// its syntax.  Doesn't touch the State, so it can run on any thread.
+  static bool LexStatement(Lexer* lexer, Lexer::Token token, Statement* st,
+                           string* err);
+
+  /// Add a statement read by LexStatement() to the State.  Files it
+  /// includes are taken from \a prefetcher if not NULL.
+  bool ApplyStatement(const Statement& st, Prefetcher* prefetcher,
+                      string* err);
 
-  /// Parse either a 'subninja' or 'include' line.
-  bool ParseFileInclude(bool new_scope, string* err);
+  /// Add an edge whose bindings have been read into \a env.  Errors are
+  /// reported against lexer_'s last token.
+  bool AddEdge(const Rule* rule, BindingEnv* env,
+               const vector<EvalString>& ins, const vector<EvalString>& outs,
+               int implicit, int order_only, string* err);
 
-  /// If the next token is not \a expected, produce an error string
-  /// saying "expectd foo, got bar".
-  bool ExpectToken(Lexer::Token expected, string* err);
+  /// Load a 'subninja' or 'include' file.  Errors reading it are reported
+  /// against lexer_'s last token.
+  bool LoadInclude(const string& path, bool new_scope, Prefetcher* prefetcher,
+                   string* err);
 
   State* state_;
   BindingEnv* env_;
   FileReader* file_reader_;
   Lexer lexer_;
+  int threads_;
 };
 
 #endif  // NINJA_MANIFEST_PARSER_H_
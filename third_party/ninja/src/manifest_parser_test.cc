@@ -758,6 +758,59 @@ TEST_F(ParserTest, Errors) {
   }
 }
 
+TEST_F(ParserTest, ErrorsBeforeSyntaxErrors) {
+  // Errors in the part of a statement before a syntax error come first.
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("build out: nosuchrule in\n"
+                                  "  foo = bar $", &err));
+    EXPECT_EQ("input:1: unknown build rule 'nosuchrule'\n"
+              "build out: nosuchrule in\n"
+              "         ^ near here"
+              , err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("rule cc\n"
+                                  "  command = cc\n"
+                                  "rule cc\n"
+                                  "  command = $", &err));
+    EXPECT_EQ("input:3: duplicate rule 'cc'\n"
+              "rule cc\n"
+              "       ^ near here"
+              , err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("pool foo\n"
+                                  "  depth = -1\n"
+                                  "  bar = 1\n", &err));
+    EXPECT_EQ("input:2: invalid pool depth\n"
+              "  depth = -1\n"
+              "            ^ near here"
+              , err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("default nosuchtarget :\n", &err));
+    EXPECT_EQ("input:1: unknown target 'nosuchtarget'\n"
+              "default nosuchtarget :\n"
+              "                    ^ near here"
+              , err);
+  }
+}
+
 TEST_F(ParserTest, MissingInput) {
   State state;
   ManifestParser parser(&state, this);
@@ -933,3 +986,134 @@ TEST_F(ParserTest, CRLF) {
       "  description = YAY!\r\n",
       &err));
 }
+
+/// Loads manifests with several threads and compares them against the
+/// serial parser.  ReadFile() is then called from worker threads, so it
+/// must not record which files were read.
+struct ParallelParserTest : public ParserTest {
+  virtual bool ReadFile(const string& path, string* content, string* err) {
+    map<string, string>::const_iterator i = files_.find(path);
+    if (i == files_.end()) {
+      *err = "No such file or directory";
+      return false;
+    }
+    *content = i->second;
+    return true;
+  }
+
+  /// Load build.ninja with \a threads threads and return the commands of
+  /// the edges it declares, one per line.
+  string Load(int threads, string* err) {
+    State state;
+    ManifestParser parser(&state, this);
+    parser.set_threads(threads);
+    err->clear();
+    parser.Load("build.ninja", err);
+    string commands;
+    for (vector<Edge*>::iterator e = state.edges_.begin();
+         e != state.edges_.end(); ++e) {
+      commands += (*e)->EvaluateCommand() + "\n";
+    }
+    return commands;
+  }
+
+  /// Check that loading build.ninja on several threads gives the same
+  /// edges and error as loading it serially, and return the error.
+  string ExpectSameAsSerial() {
+    string serial_err, parallel_err;
+    string serial = Load(1, &serial_err);
+    string parallel = Load(4, &parallel_err);
+    EXPECT_EQ(serial, parallel);
+    EXPECT_EQ(serial_err, parallel_err);
+    return parallel_err;
+  }
+};
+
+TEST_F(ParallelParserTest, SubNinjas) {
+  string root = "rule echo\n"
+                "  command = echo $var $in > $out\n"
+                "var = root\n"
+                "dir = sub\n";
+  for (int i = 0; i < 20; ++i) {
+    char name[32];
+    sprintf(name, "sub%d.ninja", i);
+    root += string("subninja ${dir}") + (name + 3) + "\n";
+    files_[name] = string("var = ") + name + "\n"
+                   "build out" + (name + 3) + ": echo in\n"
+                   "subninja nested.ninja\n"
+                   "build out2" + (name + 3) + ": echo in\n";
+    if (i == 10) {
+      // Changes the path of later subninjas, which the prefetcher can't see.
+      root += "include dir.ninja\n";
+    }
+  }
+  root += "build all: echo in\n";
+  files_["build.ninja"] = root;
+  files_["dir.ninja"] = "dir = other\n";
+  files_["nested.ninja"] = "build nested_$var: echo in\n";
+  for (int i = 11; i < 20; ++i) {
+    char name[32];
+    sprintf(name, "other%d.ninja", i);
+    files_[name] = "build other_" + string(name) + ": echo in\n";
+  }
+
+  EXPECT_EQ("", ExpectSameAsSerial());
+  string err;
+  string commands = Load(4, &err);
+  EXPECT_NE(string::npos, commands.find("echo sub3.ninja in > nested_sub3"));
+  EXPECT_NE(string::npos, commands.find("echo root in > other_other15"));
+  EXPECT_EQ(string::npos, commands.find("sub15.ninja"));
+}
+
+TEST_F(ParallelParserTest, Errors) {
+  const char* kCases[] = {
+    "rule cat\n  command = cat\n",
+    "build x: nosuchrule\n",
+    "pool p\n  depth = -1\n",
+    "pool p\n  depth = 1\npool p\n  depth = 1\n",
+    "build x: cat\n  pool = nosuchpool\n",
+    "build x y: cat\n  deps = gcc\n",
+    "build $empty: cat\n",
+    "default nosuchtarget\n",
+    "default before $empty\n",
+    "build x: cat\nbuild\n",
+    "build x: cat | $\n",
+    "subninja nosuchfile.ninja\n",
+    "build x: nosuchrule\n  foo = $",
+    "rule cat\n  command = $",
+    "pool p\n  depth = -1\n  bar = 1\n",
+    "default nosuchtarget :\n",
+  };
+  files_["build.ninja"] = "rule cat\n"
+                          "  command = cat\n"
+                          "build a: cat\n"
+                          "subninja sub.ninja\n"
+                          "build b: cat\n";
+  for (size_t i = 0; i < sizeof(kCases) / sizeof(kCases[0]); ++i) {
+    files_["sub.ninja"] = string("build before: cat\n") + kCases[i];
+    EXPECT_NE("", ExpectSameAsSerial());
+  }
+}
+
+TEST_F(ParallelParserTest, WrongGuesses) {
+  // Every subninja path depends on a binding from an included file, so the
+  // prefetcher guesses all of them wrong.  Far more files than it lexes
+  // ahead must still load.
+  string root = "rule echo\n"
+                "  command = echo $in > $out\n"
+                "include dir.ninja\n";
+  for (int i = 0; i < 100; ++i) {
+    char name[32];
+    sprintf(name, "sub%d.ninja", i);
+    root += string("subninja $dir/") + name + "\n";
+    files_[string("real/") + name] = string("build out_") + name + ": echo in\n";
+  }
+  files_["build.ninja"] = root;
+  files_["dir.ninja"] = "dir = real\n";
+
+  EXPECT_EQ("", ExpectSameAsSerial());
+  string err;
+  string commands = Load(4, &err);
+  EXPECT_NE(string::npos, commands.find("echo in > out_sub0.ninja"));
+  EXPECT_NE(string::npos, commands.find("echo in > out_sub99.ninja"));
+}
@@ -87,6 +87,15 @@ struct Stopwatch {
       g_metrics ? g_metrics->NewMetric(name) : NULL;                    \
   ScopedMetric metrics_h_scoped(metrics_h_metric);
 
+/// Count each time a code path is taken, without timing it.
+#define METRIC_COUNT(name)                                              \
+  do {                                                                  \
+    static Metric* metrics_h_metric =                                   \
+        g_metrics ? g_metrics->NewMetric(name) : NULL;                  \
+    if (metrics_h_metric)                                               \
+      metrics_h_metric->count++;                                        \
+  } while (0)
+
 extern Metrics* g_metrics;
 
 #endif // NINJA_METRICS_H_
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #endif
 
+#include "action_cache.h"
 #include "browse.h"
 #include "build.h"
 #include "build_log.h"
@@ -70,7 +71,8 @@ struct Options {
 /// to poke into these, so store them as fields on an object.
 struct NinjaMain : public BuildLogUser {
   NinjaMain(const char* ninja_command, const BuildConfig& config) :
-      ninja_command_(ninja_command), config_(config) {}
+      ninja_command_(ninja_command), config_(config),
+      action_cache_(&disk_interface_) {}
 
   /// Command line used to run Ninja.
   const char* ninja_command_;
@@ -90,6 +92,9 @@ struct NinjaMain : public BuildLogUser {
   BuildLog build_log_;
   DepsLog deps_log_;
 
+  /// The action cache named by $NINJA_ACTION_CACHE, if any.
+  ActionCache action_cache_;
+
   /// The type of functions that are the entry points to tools (subcommands).
   typedef int (NinjaMain::*ToolFunc)(int, char**);
 
@@ -135,6 +140,11 @@ struct NinjaMain : public BuildLogUser {
   /// @return an exit code.
   int RunBuild(int argc, char** argv);
 
+  /// Open the action cache if $NINJA_ACTION_CACHE names one.
+  /// Sets \a enabled to whether it did.
+  /// @return false on error.
+  bool OpenActionCache(bool* enabled);
+
   /// Dump the output requested by '-d stats'.
   void DumpMetrics();
 
@@ -187,6 +197,8 @@ void Usage(const BuildConfig& config) {
 "\n"
 "options:\n"
 "  --version  print ninja version (\"%s\")\n"
+"  --critical-path\n"
+"    start the longest chains of commands first\n"
 "\n"
 "  -C DIR   change to DIR before doing anything else\n"
 "  -f FILE  specify input build file [default=build.ninja]\n"
@@ -764,6 +776,7 @@ bool DebugEnable(const string& name) {
 #ifdef _WIN32
 "  nostatcache  don't batch stat() calls per directory and cache them\n"
 #endif
+"  parallelparse  lex subninja files on several threads (experimental)\n"
 "multiple modes can be enabled via -d FOO -d BAR\n");
     return false;
   } else if (name == "stats") {
@@ -778,10 +791,13 @@ bool DebugEnable(const string& name) {
   } else if (name == "nostatcache") {
     g_experimental_statcache = false;
     return true;
+  } else if (name == "parallelparse") {
+    g_experimental_parallel_parse = true;
+    return true;
   } else {
     const char* suggestion =
         SpellcheckString(name.c_str(), "stats", "explain", "keeprsp",
-        "nostatcache", NULL);
+        "nostatcache", "parallelparse", NULL);
     if (suggestion) {
       Error("unknown debug setting '%s', did you mean '%s'?",
             name.c_str(), suggestion);
@@ -860,6 +876,41 @@ bool NinjaMain::OpenDepsLog(bool recompact_only) {
   return true;
 }
 
+bool NinjaMain::OpenActionCache(bool* enabled) {
+  *enabled = false;
+  const char* dir = getenv("NINJA_ACTION_CACHE");
+  if (!dir || !*dir || config_.dry_run)
+    return true;
+
+  int64_t max_size = 5LL << 30;
+  if (const char* size = getenv("NINJA_ACTION_CACHE_SIZE")) {
+    char* end;
+    max_size = strtoll(size, &end, 10);
+    int shift = 0;
+    switch (*end) {
+    case 'K': shift = 10; break;
+    case 'M': shift = 20; break;
+    case 'G': shift = 30; break;
+    }
+    if (shift) {
+      max_size <<= shift;
+      ++end;
+    }
+    if (end == size || *end != '\0' || max_size <= 0) {
+      Error("invalid NINJA_ACTION_CACHE_SIZE '%s'", size);
+      return false;
+    }
+  }
+
+  string err;
+  if (!action_cache_.Open(dir, max_size, &err)) {
+    Error("opening action cache: %s", err.c_str());
+    return false;
+  }
+  *enabled = true;
+  return true;
+}
+
 void NinjaMain::DumpMetrics() {
   g_metrics->Report();
 
@@ -892,7 +943,13 @@ int NinjaMain::RunBuild(int argc, char** argv) {
 
   disk_interface_.AllowStatCache(g_experimental_statcache);
 
+  bool use_action_cache;
+  if (!OpenActionCache(&use_action_cache))
+    return 1;
+
   Builder builder(&state_, config_, &build_log_, &deps_log_, &disk_interface_);
+  if (use_action_cache)
+    builder.SetActionCache(&action_cache_);
   for (size_t i = 0; i < targets.size(); ++i) {
     if (!builder.AddTarget(targets[i], &err)) {
       if (!err.empty()) {
@@ -913,7 +970,10 @@ int NinjaMain::RunBuild(int argc, char** argv) {
     return 0;
   }
 
-  if (!builder.Build(&err)) {
+  bool success = builder.Build(&err);
+  if (use_action_cache)
+    action_cache_.Trim();
+  if (!success) {
     printf("ninja: build stopped: %s.\n", err.c_str());
     if (err.find("interrupted by user") != string::npos) {
       return 2;
@@ -953,10 +1013,11 @@ int ReadFlags(int* argc, char*** argv,
               Options* options, BuildConfig* config) {
   config->parallelism = GuessParallelism();
 
-  enum { OPT_VERSION = 1 };
+  enum { OPT_VERSION = 1, OPT_CRITICAL_PATH };
   const option kLongOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "version", no_argument, NULL, OPT_VERSION },
+    { "critical-path", no_argument, NULL, OPT_CRITICAL_PATH },
     { NULL, 0, NULL, 0 }
   };
 
@@ -1017,6 +1078,9 @@ int ReadFlags(int* argc, char*** argv,
       case OPT_VERSION:
         printf("%s\n", kNinjaVersion);
         return 0;
+      case OPT_CRITICAL_PATH:
+        config->critical_path_scheduling = true;
+        break;
       case 'h':
       default:
         Usage(*config);
@@ -1068,6 +1132,8 @@ int real_main(int argc, char** argv) {
 
     RealFileReader file_reader;
     ManifestParser parser(&ninja.state_, &file_reader);
+    if (g_experimental_parallel_parse)
+      parser.set_threads(GetProcessorCount());
     string err;
     if (!parser.Load(options.input_file, &err)) {
       Error("%s", err.c_str());
@@ -0,0 +1,27 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_SHA256_H_
+#define NINJA_SHA256_H_
+
+#include <string>
+using namespace std;
+
+#include "string_piece.h"
+
+/// Returns the SHA-256 digest of \a data (FIPS 180-4) as 64 lowercase hex
+/// digits.
+string Sha256Hex(StringPiece data);
+
+#endif  // NINJA_SHA256_H_
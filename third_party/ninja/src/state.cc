@@ -23,6 +23,12 @@
 #include "util.h"
 
 
+bool EdgePriorityLess::operator()(const Edge* e1, const Edge* e2) const {
+  if (e1->critical_path_weight() != e2->critical_path_weight())
+    return e1->critical_path_weight() > e2->critical_path_weight();
+  return e1 < e2;
+}
+
 void Pool::EdgeScheduled(const Edge& edge) {
   if (depth_ != 0)
     current_use_ += edge.weight();
@@ -38,7 +44,7 @@ void Pool::DelayEdge(Edge* edge) {
   delayed_.insert(edge);
 }
 
-void Pool::RetrieveReadyEdges(set<Edge*>* ready_queue) {
+void Pool::RetrieveReadyEdges(EdgePriorityQueue* ready_queue) {
   DelayedEdges::iterator it = delayed_.begin();
   while (it != delayed_.end()) {
     Edge* edge = *it;
@@ -51,6 +57,11 @@ void Pool::RetrieveReadyEdges(set<Edge*>* ready_queue) {
   delayed_.erase(delayed_.begin(), it);
 }
 
+void Pool::ResortDelayedEdges() {
+  DelayedEdges delayed(delayed_.begin(), delayed_.end(), &WeightedEdgeCmp);
+  delayed_.swap(delayed);
+}
+
 void Pool::Dump() const {
   printf("%s (%d/%d) ->\n", name_.c_str(), current_use_, depth_);
   for (DelayedEdges::const_iterator it = delayed_.begin();
@@ -64,6 +75,8 @@ void Pool::Dump() const {
 bool Pool::WeightedEdgeCmp(const Edge* a, const Edge* b) {
   if (!a) return b;
   if (!b) return false;
+  if (a->critical_path_weight() != b->critical_path_weight())
+    return a->critical_path_weight() > b->critical_path_weight();
   int weight_diff = a->weight() - b->weight();
   return ((weight_diff < 0) || (weight_diff == 0 && a < b));
 }
@@ -28,6 +28,14 @@ struct Edge;
 struct Node;
 struct Rule;
 
+/// Orders the edges that are ready to run: edges with a larger critical path
+/// weight come first, and ties are broken by address so the order is strict.
+/// With no weights computed this is plain address order.
+struct EdgePriorityLess {
+  bool operator()(const Edge* e1, const Edge* e2) const;
+};
+typedef set<Edge*, EdgePriorityLess> EdgePriorityQueue;
+
 /// A pool for delayed edges.
 /// Pools are scoped to a State. Edges within a State will share Pools. A Pool
 /// will keep a count of the total 'weight' of the currently scheduled edges. If
@@ -60,7 +68,10 @@ struct Pool {
   void DelayEdge(Edge* edge);
 
   /// Pool will add zero or more edges to the ready_queue
-  void RetrieveReadyEdges(set<Edge*>* ready_queue);
+  void RetrieveReadyEdges(EdgePriorityQueue* ready_queue);
+
+  /// Re-sorts the delayed edges after their critical path weights changed.
+  void ResortDelayedEdges();
 
   /// Dump the Pool and its edges (useful for debugging).
   void Dump() const;
@@ -73,6 +84,7 @@ struct Pool {
   int current_use_;
   int depth_;
 
+  /// Orders delayed edges like EdgePriorityLess, then by weight.
   static bool WeightedEdgeCmp(const Edge* a, const Edge* b);
 
   typedef set<Edge*,bool(*)(const Edge*, const Edge*)> DelayedEdges;
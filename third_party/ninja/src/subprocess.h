@@ -61,17 +61,23 @@ struct Subprocess {
   char overlapped_buf_[4 << 10];
   bool is_reading_;
 #else
+  /// Close fd_, taking it out of the SubprocessSet's epoll set first.
+  void ClosePipe();
+
   int fd_;
   pid_t pid_;
+#ifdef USE_EPOLL
+  int epoll_fd_;
+#endif
 #endif
   bool use_console_;
 
   friend struct SubprocessSet;
 };
 
-/// SubprocessSet runs a ppoll/pselect() loop around a set of Subprocesses.
-/// DoWork() waits for any state change in subprocesses; finished_
-/// is a queue of subprocesses as they finish.
+/// SubprocessSet runs an epoll/ppoll/pselect() loop around a set of
+/// Subprocesses.  DoWork() waits for any state change in subprocesses;
+/// finished_ is a queue of subprocesses as they finish.
 struct SubprocessSet {
   SubprocessSet();
   ~SubprocessSet();
@@ -93,6 +99,13 @@ struct SubprocessSet {
 
   struct sigaction old_act_;
   sigset_t old_mask_;
+#ifdef USE_EPOLL
+  /// Watches the pipes of all running subprocesses.  Subprocess::Start()
+  /// adds each pipe and Subprocess::ClosePipe() removes it again, so
+  /// DoWork() doesn't have to pass the whole set to the kernel on every
+  /// call.
+  int epoll_fd_;
+#endif
 #endif
 };
 
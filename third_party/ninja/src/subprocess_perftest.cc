@@ -0,0 +1,171 @@
+// Copyright 2015 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how many short commands per second SubprocessSet can launch and
+// reap at a high -j, compared to launching them with fork() and waiting on
+// them with a ppoll() over all pipes, the way Subprocess used to.  A large
+// heap stands in for the State of a big build, which fork() has to copy the
+// page tables of.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <getopt.h>
+
+#include <map>
+#include <vector>
+
+#include "metrics.h"
+#include "subprocess.h"
+#include "util.h"
+
+const char kCommand[] = "true";
+
+/// Runs \a count commands, \a parallelism at a time, with fork() and
+/// poll().  Returns false if any of them fails.
+bool RunWithFork(int count, int parallelism) {
+  map<int, pid_t> running;  // By pipe fd.
+  int started = 0;
+  bool ok = true;
+  while (started < count || !running.empty()) {
+    while (started < count && (int)running.size() < parallelism) {
+      int output_pipe[2];
+      if (pipe(output_pipe) < 0)
+        Fatal("pipe: %s", strerror(errno));
+      SetCloseOnExec(output_pipe[0]);
+      pid_t pid = fork();
+      if (pid < 0)
+        Fatal("fork: %s", strerror(errno));
+      if (pid == 0) {
+        setpgid(0, 0);
+        int devnull = open("/dev/null", O_RDONLY);
+        dup2(devnull, 0);
+        dup2(output_pipe[1], 1);
+        dup2(output_pipe[1], 2);
+        execl("/bin/sh", "/bin/sh", "-c", kCommand, (char *) NULL);
+        _exit(1);
+      }
+      close(output_pipe[1]);
+      running[output_pipe[0]] = pid;
+      ++started;
+    }
+
+    // Like the ppoll() loop, rebuild the pollfd list on every iteration.
+    vector<pollfd> fds;
+    for (map<int, pid_t>::iterator i = running.begin(); i != running.end();
+         ++i) {
+      pollfd pfd = { i->first, POLLIN | POLLPRI, 0 };
+      fds.push_back(pfd);
+    }
+    if (poll(&fds.front(), fds.size(), -1) < 0)
+      Fatal("poll: %s", strerror(errno));
+    for (vector<pollfd>::iterator i = fds.begin(); i != fds.end(); ++i) {
+      if (!i->revents)
+        continue;
+      char buf[4 << 10];
+      if (read(i->fd, buf, sizeof(buf)) > 0)
+        continue;
+      close(i->fd);
+      int status;
+      if (waitpid(running[i->fd], &status, 0) < 0)
+        Fatal("waitpid: %s", strerror(errno));
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        ok = false;
+      running.erase(i->fd);
+    }
+  }
+  return ok;
+}
+
+/// Runs \a count commands, \a parallelism at a time, through a
+/// SubprocessSet.  Returns false if any of them fails.
+bool RunWithSubprocessSet(int count, int parallelism) {
+  SubprocessSet subprocs;
+  int started = 0;
+  int finished = 0;
+  bool ok = true;
+  while (finished < count) {
+    while (started < count && (int)subprocs.running_.size() < parallelism) {
+      if (!subprocs.Add(kCommand))
+        Fatal("failed to start subprocess");
+      ++started;
+    }
+    subprocs.DoWork();
+    while (Subprocess* subproc = subprocs.NextFinished()) {
+      if (subproc->Finish() != ExitSuccess)
+        ok = false;
+      delete subproc;
+      ++finished;
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  int count = 2000;
+  int parallelism = 200;
+  int heap_mb = 512;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("n:j:m:h"))) != -1) {
+    switch (opt) {
+    case 'n':
+      count = atoi(optarg);
+      break;
+    case 'j':
+      parallelism = atoi(optarg);
+      break;
+    case 'm':
+      heap_mb = atoi(optarg);
+      break;
+    case 'h':
+    default:
+      printf("usage: subprocess_perftest [options]\n"
+"\n"
+"options:\n"
+"  -n N   run N commands [default=2000]\n"
+"  -j N   run N commands in parallel [default=200]\n"
+"  -m MB  touch MB megabytes of heap first [default=512]\n");
+      return 1;
+    }
+  }
+
+  // Touch every page, so that fork() has page tables to copy.
+  vector<char> heap((size_t)heap_mb << 20);
+  for (size_t i = 0; i < heap.size(); i += 4096)
+    heap[i] = 1;
+
+  printf("%d x '%s' at -j%d with a %dMB heap\n", count, kCommand,
+         parallelism, heap_mb);
+  for (int pass = 0; pass < 2; ++pass) {
+    int64_t start = GetTimeMillis();
+    bool ok = pass == 0 ? RunWithFork(count, parallelism)
+                        : RunWithSubprocessSet(count, parallelism);
+    int delta = (int)(GetTimeMillis() - start);
+    if (!ok) {
+      fprintf(stderr, "a command failed\n");
+      return 1;
+    }
+    printf("%-15s %dms  %.0f commands/s\n",
+           pass == 0 ? "fork + poll:" : "SubprocessSet:", delta,
+           count * 1000.0 / (delta > 0 ? delta : 1));
+  }
+  return 0;
+}
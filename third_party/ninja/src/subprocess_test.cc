@@ -166,6 +166,30 @@ TEST_F(SubprocessTest, SetWithMulti) {
   }
 }
 
+TEST_F(SubprocessTest, SetWithReuse) {
+  // Start new commands as earlier ones finish and are deleted, the way a
+  // build does, so pipe fds and Subprocess addresses get reused while
+  // other commands are still starting up.
+  const int kNumProcs = 200;
+  const size_t kParallelism = 20;
+  int started = 0;
+  int finished = 0;
+  while (finished < kNumProcs) {
+    while (started < kNumProcs && subprocs_.running_.size() < kParallelism) {
+      ASSERT_NE((Subprocess *) 0, subprocs_.Add(kSimpleCommand));
+      ++started;
+    }
+    subprocs_.DoWork();
+    while (Subprocess* subproc = subprocs_.NextFinished()) {
+      ASSERT_EQ(ExitSuccess, subproc->Finish());
+      ASSERT_NE("", subproc->GetOutput());
+      delete subproc;
+      ++finished;
+    }
+  }
+  ASSERT_EQ(0u, subprocs_.running_.size());
+}
+
 // OS X's process limit is less than 1025 by default
 // (|sysctl kern.maxprocperuid| is 709 on 10.7 and 10.8 and less prior to that).
 #if !defined(__APPLE__) && !defined(_WIN32)
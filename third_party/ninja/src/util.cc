@@ -35,6 +35,7 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #endif
 
@@ -394,6 +395,62 @@ int ReadFile(const string& path, string* contents, string* err) {
 #endif
 }
 
+int MappedFile::Open(const string& path, string* err) {
+  Close();
+#ifdef _WIN32
+  int ret = ::ReadFile(path, &contents_, err);
+  if (ret < 0)
+    return ret;
+  data_ = contents_.data();
+  size_ = contents_.size();
+  return 0;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    err->assign(strerror(errno));
+    return -errno;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int saved_errno = errno;
+    err->assign(strerror(saved_errno));
+    close(fd);
+    return -saved_errno;
+  }
+  if (st.st_size == 0) {
+    // mmap() rejects empty mappings.
+    close(fd);
+    data_ = "";
+    return 0;
+  }
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int saved_errno = errno;
+  close(fd);
+  if (data == MAP_FAILED) {
+    err->assign(strerror(saved_errno));
+    return -saved_errno;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+  return 0;
+#endif
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+  contents_.clear();
+#else
+  if (size_)
+    munmap(const_cast<char*>(data_), size_);
+#endif
+  data_ = NULL;
+  size_ = 0;
+}
+
 void SetCloseOnExec(int fd) {
 #ifndef _WIN32
   int flags = fcntl(fd, F_GETFD);
@@ -59,6 +59,33 @@ void GetWin32EscapedString(const string& input, string* result);
 /// Returns -errno and fills in \a err on error.
 int ReadFile(const string& path, string* contents, string* err);
 
+/// A read-only view of the whole contents of a file, for parsing it in place.
+/// On POSIX the file is mmap()ed; on Windows it is read into memory.
+struct MappedFile {
+  MappedFile() : data_(NULL), size_(0) {}
+  ~MappedFile() { Close(); }
+
+  /// Map the file at \a path.
+  /// Returns -errno and fills in \a err on error.
+  int Open(const string& path, string* err);
+
+  /// Release the mapping.  Safe to call more than once.
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+#ifdef _WIN32
+  string contents_;
+#endif
+
+  MappedFile(const MappedFile&);        // DO NOT IMPLEMENT
+  void operator=(const MappedFile&);    // DO NOT IMPLEMENT
+};
+
 /// Mark a file descriptor to not be inherited on exec()s.
 void SetCloseOnExec(int fd);
 
@@ -0,0 +1,176 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Compares the throughput of arenas with and without an ArenaBlockPool on a
+// simulated server that handles each request on an arena of its own, both
+// when each request gets a new arena and when one arena is reset between
+// requests, e.g.
+//
+//   arena_bench 4
+//
+// runs the requests on four threads.  Also reports the stats of an arena
+// that all threads share.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <vector>
+
+#include <google/protobuf/arena.h>
+#include <google/protobuf/stubs/common.h>
+
+using google::protobuf::Arena;
+using google::protobuf::ArenaBlockPool;
+using google::protobuf::ArenaOptions;
+using google::protobuf::ArenaStats;
+using google::protobuf::scoped_ptr;
+using google::protobuf::uint32;
+
+namespace {
+
+const int kDefaultThreads = 4;
+const int kIterations = 20000;
+const int kSharedArenaIterations = 1000;
+
+double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Every request makes a few dozen allocations of assorted sizes and then
+// throws its arena away, either by destroying it or by resetting it.
+struct Benchmark {
+  ArenaOptions options;
+  bool reuse_arena;
+  Arena* shared_arena;  // If set, all threads allocate from this arena.
+  int iterations;
+
+  static void* Run(void* arg) {
+    const Benchmark* benchmark = static_cast<Benchmark*>(arg);
+    Arena arena(benchmark->options);
+    uint32 seed = 1;
+    for (int i = 0; i < benchmark->iterations; i++) {
+      Arena* request_arena = benchmark->shared_arena;
+      scoped_ptr<Arena> new_arena;
+      if (request_arena == NULL) {
+        if (benchmark->reuse_arena) {
+          request_arena = &arena;
+        } else {
+          new_arena.reset(new Arena(benchmark->options));
+          request_arena = new_arena.get();
+        }
+      }
+      for (int j = 0; j < 64; j++) {
+        seed = seed * 1103515245 + 12345;
+        char* p =
+            Arena::CreateArray<char>(request_arena, 1 + (seed >> 16) % 512);
+        p[0] = 1;
+      }
+      if (benchmark->reuse_arena && benchmark->shared_arena == NULL) {
+        arena.Reset();
+      }
+    }
+    return NULL;
+  }
+
+  // Runs the requests on num_threads threads and returns the number of
+  // requests per second.
+  double RunThreads(int num_threads) {
+    std::vector<pthread_t> threads(num_threads);
+    double start = Now();
+    for (int i = 0; i < num_threads; i++) {
+      pthread_create(&threads[i], NULL, &Run, this);
+    }
+    for (int i = 0; i < num_threads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    return iterations * num_threads / (Now() - start);
+  }
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  int threads = argc > 1 ? atoi(argv[1]) : kDefaultThreads;
+  if (argc > 2 || threads < 1) {
+    fprintf(stderr, "Usage: %s [<threads>]\n", argv[0]);
+    return 1;
+  }
+
+  for (int reuse_arena = 0; reuse_arena < 2; reuse_arena++) {
+    double requests_per_second[2];
+    for (int use_pool = 0; use_pool < 2; use_pool++) {
+      ArenaBlockPool pool;
+      Benchmark benchmark;
+      if (use_pool) benchmark.options.block_pool = &pool;
+      benchmark.reuse_arena = reuse_arena;
+      benchmark.shared_arena = NULL;
+      benchmark.iterations = kIterations;
+      requests_per_second[use_pool] = benchmark.RunThreads(threads);
+      if (use_pool) {
+        ArenaBlockPool::Stats pool_stats;
+        pool.GetStats(&pool_stats);
+        printf("Pool: %llu blocks allocated, thread cache hit rate %.3f, "
+               "%llu global hits, %llu bytes cached\n",
+               static_cast<unsigned long long>(pool_stats.blocks_allocated),
+               pool_stats.thread_cache_hit_rate(),
+               static_cast<unsigned long long>(pool_stats.global_hits),
+               static_cast<unsigned long long>(pool_stats.cached_bytes));
+      }
+    }
+    printf("%s per request: %.0f requests/s, %.0f requests/s with a pool "
+           "(%d threads)\n",
+           reuse_arena ? "Reset" : "New arena", requests_per_second[0],
+           requests_per_second[1], threads);
+  }
+
+  ArenaOptions options;
+  options.record_stats = true;
+  Arena shared_arena(options);
+  Benchmark benchmark;
+  benchmark.reuse_arena = false;
+  benchmark.shared_arena = &shared_arena;
+  benchmark.iterations = kSharedArenaIterations;
+  double requests_per_second = benchmark.RunThreads(threads);
+  ArenaStats stats;
+  shared_arena.GetStats(&stats);
+  printf("Shared arena: %.0f requests/s, %llu blocks, %.1f bytes wasted per "
+         "block, thread cache hit rate %.3f, %llu cross-thread allocations\n",
+         requests_per_second,
+         static_cast<unsigned long long>(stats.blocks_allocated),
+         stats.bytes_wasted_per_block(), stats.thread_cache_hit_rate(),
+         static_cast<unsigned long long>(stats.cross_thread_allocations));
+  return 0;
+}
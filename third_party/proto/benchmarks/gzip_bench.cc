@@ -0,0 +1,172 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Compares the throughput of GzipOutputStream's multithreaded mode and
+// GzipInputStream's read-ahead mode with the single-threaded ones on a few
+// megabytes of generated text, e.g.
+//
+//   gzip_bench 4
+//
+// compresses with one and with four threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <string>
+
+#include <google/protobuf/io/gzip_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/stubs/common.h>
+#include <google/protobuf/stubs/strutil.h>
+
+using google::protobuf::SimpleItoa;
+using google::protobuf::uint32;
+using google::protobuf::io::ArrayInputStream;
+using google::protobuf::io::GzipInputStream;
+using google::protobuf::io::GzipOutputStream;
+using google::protobuf::io::StringOutputStream;
+using std::string;
+
+namespace {
+
+const int kDataSize = 16 << 20;
+const int kDefaultThreads = 4;
+const int kReadAheadBuffers = 4;
+
+double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Numbers separated by spaces and newlines, which compress about as well
+// as typical text.
+string GenerateData() {
+  string data;
+  uint32 seed = 1;
+  while (static_cast<int>(data.size()) < kDataSize) {
+    seed = seed * 1103515245 + 12345;
+    data += SimpleItoa(seed >> 16 & 0xfff);
+    data += (seed >> 8) & 1 ? ' ' : '\n';
+  }
+  return data;
+}
+
+bool Compress(const string& data, int threads, string* compressed) {
+  StringOutputStream output(compressed);
+  GzipOutputStream::Options options;
+  options.num_threads = threads;
+  GzipOutputStream gzout(&output, options);
+  void* buffer;
+  int size;
+  int position = 0;
+  while (position < static_cast<int>(data.size())) {
+    if (!gzout.Next(&buffer, &size)) return false;
+    int n = std::min(size, static_cast<int>(data.size()) - position);
+    memcpy(buffer, data.data() + position, n);
+    gzout.BackUp(size - n);
+    position += n;
+  }
+  return gzout.Close();
+}
+
+bool Uncompress(const string& compressed, int read_ahead_buffers,
+                string* data) {
+  ArrayInputStream input(compressed.data(), compressed.size());
+  GzipInputStream gzin(&input, GzipInputStream::GZIP, -1,
+                       read_ahead_buffers);
+  const void* buffer;
+  int size;
+  while (gzin.Next(&buffer, &size)) {
+    data->append(static_cast<const char*>(buffer), size);
+  }
+  return gzin.ZlibErrorCode() == Z_STREAM_END;
+}
+
+void Report(const char* name, double seconds, const string& compressed) {
+  printf("%s: %.3fs; %.2fMB/s (%d compressed bytes)\n", name, seconds,
+         kDataSize / (seconds * 1024 * 1024),
+         static_cast<int>(compressed.size()));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  int threads = argc > 1 ? atoi(argv[1]) : kDefaultThreads;
+  if (argc > 2 || threads < 1) {
+    fprintf(stderr, "Usage: %s [<compression threads>]\n", argv[0]);
+    return 1;
+  }
+
+  string data = GenerateData();
+  string compressed[2];
+  const int thread_counts[2] = {1, threads};
+  for (int i = 0; i < 2; ++i) {
+    double start = Now();
+    if (!Compress(data, thread_counts[i], &compressed[i])) {
+      fprintf(stderr, "Compressing with %d threads failed\n",
+              thread_counts[i]);
+      return 1;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "Compress with %d threads",
+             thread_counts[i]);
+    Report(name, Now() - start, compressed[i]);
+  }
+
+  string uncompressed;
+  if (!Uncompress(compressed[1], 0, &uncompressed) || uncompressed != data) {
+    fprintf(stderr, "Output compressed with %d threads is corrupt\n",
+            threads);
+    return 1;
+  }
+
+  const int read_ahead_buffers[2] = {0, kReadAheadBuffers};
+  for (int i = 0; i < 2; ++i) {
+    string uncompressed;
+    double start = Now();
+    if (!Uncompress(compressed[0], read_ahead_buffers[i], &uncompressed) ||
+        uncompressed != data) {
+      fprintf(stderr, "Uncompressing with %d read-ahead buffers failed\n",
+              read_ahead_buffers[i]);
+      return 1;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "Uncompress with %d read-ahead buffers",
+             read_ahead_buffers[i]);
+    Report(name, Now() - start, compressed[0]);
+  }
+  return 0;
+}
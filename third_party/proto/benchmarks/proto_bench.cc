@@ -0,0 +1,285 @@
+// Protocol Buffers - Google's data interchange format
+// Copyright 2008 Google Inc.  All rights reserved.
+// https://developers.google.com/protocol-buffers/
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// The C++ counterpart of ProtoBench.java.  Each pair of arguments names a
+// message type and a file holding an encoded message of that type, e.g.
+//
+//   proto_bench benchmarks.SpeedMessage1 google_message1.dat
+//               benchmarks.SpeedMessage2 google_message2.dat
+//
+// Afterwards a benchmarks.PackedMessage with large packed repeated fields
+// is generated and run through the same benchmarks.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/stubs/common.h>
+
+#include "benchmarks/google_packed.pb.h"
+
+using google::protobuf::Descriptor;
+using google::protobuf::DescriptorPool;
+using google::protobuf::Message;
+using google::protobuf::MessageFactory;
+using google::protobuf::int32;
+using google::protobuf::int64;
+using google::protobuf::scoped_ptr;
+using google::protobuf::uint32;
+using google::protobuf::uint64;
+using google::protobuf::io::ArrayInputStream;
+using google::protobuf::io::FileOutputStream;
+using std::string;
+
+namespace {
+
+const int kWarmupIterations = 10;
+const double kMinSampleTime = 1.0;  // seconds
+const double kTargetTime = 5.0;  // seconds
+
+// Size of the chunks the "stream" benchmarks hand to the parser, so that
+// values regularly straddle buffer boundaries.
+const int kStreamBlockSize = 4096;
+
+// Number of values in each field of the generated PackedMessage.
+const int kPackedValues = 100000;
+
+// The state the benchmarked actions work on.
+struct Context {
+  const Message* sample;
+  scoped_ptr<Message> message;  // Reused by the parsing actions.
+  string data;
+  string output;
+  int dev_null;
+};
+
+typedef bool (*Action)(Context* context);
+
+bool SerializeToString(Context* context) {
+  return context->sample->SerializeToString(&context->output);
+}
+
+bool SerializeToArray(Context* context) {
+  int size = context->sample->ByteSize();
+  context->output.resize(size);
+  return context->sample->SerializeWithCachedSizesToArray(
+      reinterpret_cast<google::protobuf::uint8*>(&context->output[0])) ==
+      reinterpret_cast<google::protobuf::uint8*>(&context->output[0]) + size;
+}
+
+bool SerializeToDevNull(Context* context) {
+  FileOutputStream output(context->dev_null);
+  return context->sample->SerializeToZeroCopyStream(&output) &&
+         output.Flush();
+}
+
+bool ParseFromString(Context* context) {
+  scoped_ptr<Message> message(context->sample->New());
+  return message->ParseFromString(context->data);
+}
+
+bool ParseFromStringReusingMessage(Context* context) {
+  return context->message->ParseFromString(context->data);
+}
+
+bool ParseFromStream(Context* context) {
+  ArrayInputStream input(context->data.data(), context->data.size(),
+                         kStreamBlockSize);
+  return context->message->ParseFromZeroCopyStream(&input);
+}
+
+double Now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Runs action the given number of times and sets *elapsed to the time that
+// took, in seconds.
+bool TimeAction(Action action, Context* context, int iterations,
+                double* elapsed) {
+  double start = Now();
+  for (int i = 0; i < iterations; ++i) {
+    if (!action(context)) return false;
+  }
+  *elapsed = Now() - start;
+  return true;
+}
+
+bool Benchmark(const char* name, Action action, Context* context) {
+  double elapsed;
+  if (!TimeAction(action, context, kWarmupIterations, &elapsed)) {
+    fprintf(stderr, "%s failed\n", name);
+    return false;
+  }
+
+  int iterations = 1;
+  TimeAction(action, context, iterations, &elapsed);
+  while (elapsed < kMinSampleTime) {
+    iterations *= 2;
+    TimeAction(action, context, iterations, &elapsed);
+  }
+
+  iterations = static_cast<int>(kTargetTime / elapsed * iterations);
+  if (iterations < 1) iterations = 1;
+  TimeAction(action, context, iterations, &elapsed);
+  printf("%s: %d iterations in %.3fs; %.2fMB/s\n", name, iterations, elapsed,
+         iterations * static_cast<double>(context->data.size()) /
+             (elapsed * 1024 * 1024));
+  return true;
+}
+
+bool RunBenchmarks(Context* context) {
+  context->message.reset(context->sample->New());
+  return Benchmark("Serialize to string", &SerializeToString, context) &&
+         Benchmark("Serialize to array", &SerializeToArray, context) &&
+         Benchmark("Serialize to /dev/null with FileOutputStream",
+                   &SerializeToDevNull, context) &&
+         Benchmark("Deserialize from string", &ParseFromString, context) &&
+         Benchmark("Deserialize from string reusing message",
+                   &ParseFromStringReusingMessage, context) &&
+         Benchmark("Deserialize from stream", &ParseFromStream, context);
+}
+
+bool ReadFile(const char* filename, string* data) {
+  FILE* file = fopen(filename, "rb");
+  if (file == NULL) return false;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data->append(buffer, n);
+  }
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+bool RunTest(const string& type, const char* filename, int dev_null) {
+  printf("Benchmarking %s with file %s\n", type.c_str(), filename);
+  const Descriptor* descriptor =
+      DescriptorPool::generated_pool()->FindMessageTypeByName(type);
+  if (descriptor == NULL) {
+    fprintf(stderr, "Unknown message type %s\n", type.c_str());
+    return false;
+  }
+  Context context;
+  context.sample = MessageFactory::generated_factory()->GetPrototype(
+      descriptor);
+  context.dev_null = dev_null;
+  if (!ReadFile(filename, &context.data)) {
+    fprintf(stderr, "Unable to read %s\n", filename);
+    return false;
+  }
+  scoped_ptr<Message> sample(context.sample->New());
+  if (!sample->ParseFromString(context.data)) {
+    fprintf(stderr, "Unable to parse %s\n", filename);
+    return false;
+  }
+  context.sample = sample.get();
+  bool ok = RunBenchmarks(&context);
+  printf("\n");
+  return ok;
+}
+
+// A xorshift generator, so that every run benchmarks the same values.
+uint64 NextRandom(uint64* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// Returns a random value of random bit length, so that the varint
+// encodings of the values have all sizes.
+uint64 RandomValue(uint64* state, int max_bits) {
+  uint64 value = NextRandom(state);
+  int bits = NextRandom(state) % (max_bits + 1);
+  return bits == 64 ? value : value & ((GOOGLE_ULONGLONG(1) << bits) - 1);
+}
+
+bool RunPackedTest(int dev_null) {
+  printf("Benchmarking benchmarks.PackedMessage with %d values per field\n",
+         kPackedValues);
+  benchmarks::PackedMessage sample;
+  uint64 state = GOOGLE_ULONGLONG(88172645463325252);
+  for (int i = 0; i < kPackedValues; ++i) {
+    sample.add_field1(static_cast<int32>(RandomValue(&state, 32)));
+    sample.add_field2(static_cast<int64>(RandomValue(&state, 64)));
+    sample.add_field3(static_cast<uint32>(RandomValue(&state, 32)));
+    sample.add_field4(RandomValue(&state, 64));
+    sample.add_field5(static_cast<int32>(RandomValue(&state, 32)));
+    sample.add_field6(static_cast<int64>(RandomValue(&state, 64)));
+    sample.add_field7(NextRandom(&state) & 1);
+    sample.add_field8(static_cast<uint32>(NextRandom(&state)));
+    sample.add_field9(static_cast<double>(NextRandom(&state)));
+  }
+  Context context;
+  context.sample = &sample;
+  context.dev_null = dev_null;
+  sample.SerializeToString(&context.data);
+  bool ok = RunBenchmarks(&context);
+  printf("\n");
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  if (argc % 2 != 1) {
+    fprintf(stderr,
+            "Usage: %s [<message type> <input data>]...\n"
+            "The message type is the fully-qualified message name,\n"
+            "e.g. benchmarks.SpeedMessage1\n",
+            argv[0]);
+    return 1;
+  }
+
+  int dev_null = open("/dev/null", O_WRONLY);
+  if (dev_null < 0) {
+    perror("/dev/null");
+    return 1;
+  }
+  bool success = true;
+  for (int i = 1; i < argc; i += 2) {
+    success &= RunTest(argv[i], argv[i + 1], dev_null);
+  }
+  success &= RunPackedTest(dev_null);
+  close(dev_null);
+  return success ? 0 : 1;
+}
@@ -30,17 +30,30 @@
 
 #include <google/protobuf/arena.h>
 
+#include "config.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #ifdef ADDRESS_SANITIZER
 #include <sanitizer/asan_interface.h>
 #endif
 
+#include <google/protobuf/stubs/once.h>
+
 namespace google {
 namespace protobuf {
 
 google::protobuf::internal::SequenceNumber Arena::lifecycle_id_generator_;
 #ifdef PROTOBUF_USE_DLLS
 Arena::ThreadCache& Arena::thread_cache() {
-  static GOOGLE_THREAD_LOCAL ThreadCache thread_cache_ = { -1, NULL };
+  static GOOGLE_THREAD_LOCAL ThreadCache thread_cache_ = { -1, NULL, 0 };
   return thread_cache_;
 }
 #elif defined(GOOGLE_PROTOBUF_OS_ANDROID) || defined(GOOGLE_PROTOBUF_OS_IPHONE)
@@ -50,11 +63,16 @@ Arena::ThreadCache& Arena::thread_cache() {
   return *thread_cache_->Get();
 }
 #else
-GOOGLE_THREAD_LOCAL Arena::ThreadCache Arena::thread_cache_ = { -1, NULL };
+GOOGLE_THREAD_LOCAL Arena::ThreadCache Arena::thread_cache_ = { -1, NULL, 0 };
 #endif
 
 void Arena::Init() {
   lifecycle_id_ = lifecycle_id_generator_.GetNext();
+  stats_ = NULL;
+  if (options_.record_stats) {
+    stats_ = new StatsCounters;
+    memset(stats_, 0, sizeof(*stats_));
+  }
   blocks_ = 0;
   hint_ = 0;
   owns_first_block_ = true;
@@ -86,6 +104,7 @@ Arena::~Arena() {
   if (options_.on_arena_destruction != NULL) {
     options_.on_arena_destruction(this, hooks_cookie_, space_allocated);
   }
+  delete stats_;
 }
 
 uint64 Arena::Reset() {
@@ -117,7 +136,21 @@ Arena::Block* Arena::NewBlock(void* me, Block* my_last_block, size_t n,
     size = kHeaderSize + n;
   }
 
-  Block* b = reinterpret_cast<Block*>(options_.block_alloc(size));
+  Block* b;
+  if (options_.block_pool != NULL) {
+    bool reused;
+    b = reinterpret_cast<Block*>(
+        options_.block_pool->Allocate(&size, &reused));
+    if (GOOGLE_PREDICT_FALSE(stats_ != NULL)) {
+      IncrementCounter(
+          reused ? &stats_->blocks_reused : &stats_->blocks_allocated, 1);
+    }
+  } else {
+    b = reinterpret_cast<Block*>(options_.block_alloc(size));
+    if (GOOGLE_PREDICT_FALSE(stats_ != NULL)) {
+      IncrementCounter(&stats_->blocks_allocated, 1);
+    }
+  }
   b->pos = kHeaderSize + n;
   b->size = size;
   if (b->avail() == 0) {
@@ -170,10 +203,19 @@ void* Arena::AllocateAligned(const std::type_info* allocated, size_t n) {
   if (thread_cache().last_lifecycle_id_seen == lifecycle_id_ &&
       thread_cache().last_block_used_ != NULL) {
     if (thread_cache().last_block_used_->avail() < n) {
+      if (GOOGLE_PREDICT_FALSE(stats_ != NULL)) {
+        IncrementCounter(&stats_->thread_cache_misses, 1);
+      }
       return SlowAlloc(n);
     }
+    if (GOOGLE_PREDICT_FALSE(stats_ != NULL)) {
+      IncrementCounter(&stats_->thread_cache_hits, 1);
+    }
     return AllocFromBlock(thread_cache().last_block_used_, n);
   }
+  if (GOOGLE_PREDICT_FALSE(stats_ != NULL)) {
+    IncrementCounter(&stats_->thread_cache_misses, 1);
+  }
 
   // Check whether we own the last accessed block on this arena.
   // This fast path optimizes the case where a single thread uses multiple
@@ -214,6 +256,14 @@ void* Arena::SlowAlloc(size_t n) {
     google::protobuf::internal::NoBarrier_Store(&hint_, reinterpret_cast<google::protobuf::internal::AtomicWord>(b));
     return AllocFromBlock(b, n);
   }
+  if (GOOGLE_PREDICT_FALSE(stats_ != NULL) && b == NULL) {
+    // This thread has no block here yet; see whether another one does.
+    Block* hint =
+        reinterpret_cast<Block*>(google::protobuf::internal::Acquire_Load(&hint_));
+    if (hint != NULL && hint->owner != &hint->owner) {
+      IncrementCounter(&stats_->cross_thread_allocations, 1);
+    }
+  }
   b = NewBlock(me, b, n, options_.start_block_size, options_.max_block_size);
   AddBlock(b);
   if (b->owner == me) {  // If this block can be reused (see NewBlock()).
@@ -242,18 +292,44 @@ uint64 Arena::SpaceUsed() const {
   return space_used;
 }
 
+void Arena::GetStats(ArenaStats* stats) const {
+  *stats = ArenaStats();
+  if (stats_ == NULL) return;
+  using google::protobuf::internal::NoBarrier_Load;
+  stats->blocks_allocated = NoBarrier_Load(&stats_->blocks_allocated);
+  stats->blocks_reused = NoBarrier_Load(&stats_->blocks_reused);
+  stats->blocks_freed = NoBarrier_Load(&stats_->blocks_freed);
+  stats->bytes_wasted = NoBarrier_Load(&stats_->bytes_wasted);
+  stats->thread_cache_hits = NoBarrier_Load(&stats_->thread_cache_hits);
+  stats->thread_cache_misses = NoBarrier_Load(&stats_->thread_cache_misses);
+  stats->cross_thread_allocations =
+      NoBarrier_Load(&stats_->cross_thread_allocations);
+}
+
+void Arena::ReleaseBlock(Block* b) {
+  if (options_.block_pool != NULL) {
+    options_.block_pool->Release(b, b->size);
+  } else {
+    options_.block_dealloc(b, b->size);
+  }
+}
+
 uint64 Arena::FreeBlocks() {
   uint64 space_allocated = 0;
   Block* b = reinterpret_cast<Block*>(google::protobuf::internal::NoBarrier_Load(&blocks_));
   Block* first_block = NULL;
   while (b != NULL) {
     space_allocated += (b->size);
+    if (GOOGLE_PREDICT_FALSE(stats_ != NULL)) {
+      IncrementCounter(&stats_->blocks_freed, 1);
+      IncrementCounter(&stats_->bytes_wasted, b->avail());
+    }
     Block* next = b->next;
     if (next != NULL) {
-      options_.block_dealloc(b, b->size);
+      ReleaseBlock(b);
     } else {
       if (owns_first_block_) {
-        options_.block_dealloc(b, b->size);
+        ReleaseBlock(b);
       } else {
         // User passed in the first block, skip free'ing the memory.
         first_block = b;
@@ -293,5 +369,261 @@ Arena::Block* Arena::FindBlock(void* me) {
   return b;
 }
 
+namespace {
+
+// Block sizes are powers of two, so this covers every size a size_t can hold.
+const int kNumSizeClasses = sizeof(size_t) * 8;
+
+// Numbers the threads that use an ArenaBlockPool.
+google::protobuf::internal::SequenceNumber block_pool_thread_generator;
+
+// The pools that exist, so that a thread can give up its caches in all of
+// them when it exits.
+ProtobufOnceType block_pool_registry_once;
+Mutex* block_pool_registry_mutex;
+std::vector<ArenaBlockPool*>* block_pools;
+#ifdef HAVE_PTHREAD
+// Holds the thread's number for ArenaBlockPool::ThreadExited().
+pthread_key_t block_pool_thread_key;
+#endif
+
+// Returns the smallest c such that a block of size 2^c holds size bytes.
+int SizeClass(size_t size) {
+  int size_class = 0;
+  while ((static_cast<size_t>(1) << size_class) < size) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+// Adds amount to a counter that only one thread writes at a time.
+void AddToCounter(google::protobuf::internal::AtomicWord* counter,
+                  google::protobuf::internal::AtomicWord amount) {
+  google::protobuf::internal::NoBarrier_Store(
+      counter, google::protobuf::internal::NoBarrier_Load(counter) + amount);
+}
+
+}  // namespace
+
+// Free blocks are linked through their first word.
+struct ArenaBlockPool::FreeBlock {
+  FreeBlock* next;
+};
+
+// Free lists of blocks, one per size class, and the counters reported by
+// GetStats(). A per-thread cache is only modified by the thread that owns
+// it; the global list is protected by mutex. Either way there is a single
+// writer at a time, so the counters are atomic only so that GetStats() can
+// read them from another thread.
+struct ArenaBlockPool::Cache {
+  // 1 + the index of the owning thread, or 0 if the cache is unowned. Not
+  // used for the global list.
+  google::protobuf::internal::AtomicWord owner;
+  Mutex mutex;
+  FreeBlock* blocks[kNumSizeClasses];
+  google::protobuf::internal::AtomicWord num_blocks[kNumSizeClasses];
+  google::protobuf::internal::AtomicWord blocks_allocated;
+  google::protobuf::internal::AtomicWord hits;
+  google::protobuf::internal::AtomicWord blocks_freed;
+  // Keeps caches used by different threads off each other's cache lines.
+  char padding[64];
+
+  Cache() : owner(0), blocks_allocated(0), hits(0), blocks_freed(0) {
+    memset(blocks, 0, sizeof(blocks));
+    memset(num_blocks, 0, sizeof(num_blocks));
+  }
+};
+
+ArenaBlockPool::ArenaBlockPool() {
+  Init();
+}
+
+ArenaBlockPool::ArenaBlockPool(const Options& options) : options_(options) {
+  Init();
+}
+
+void ArenaBlockPool::Init() {
+  if (options_.num_thread_caches < 1) options_.num_thread_caches = 1;
+  thread_caches_ = new Cache[options_.num_thread_caches];
+  global_ = new Cache;
+
+  GoogleOnceInit(&block_pool_registry_once, &ArenaBlockPool::InitRegistry);
+  MutexLock lock(block_pool_registry_mutex);
+  block_pools->push_back(this);
+}
+
+void ArenaBlockPool::InitRegistry() {
+  block_pool_registry_mutex = new Mutex;
+  block_pools = new std::vector<ArenaBlockPool*>;
+#ifdef HAVE_PTHREAD
+  pthread_key_create(&block_pool_thread_key, &ArenaBlockPool::ThreadExited);
+#endif
+}
+
+void ArenaBlockPool::ThreadExited(void* thread) {
+  google::protobuf::internal::AtomicWord me =
+      reinterpret_cast<google::protobuf::internal::AtomicWord>(thread);
+  // Holding the mutex keeps the pools from being destroyed meanwhile.
+  MutexLock lock(block_pool_registry_mutex);
+  for (size_t i = 0; i < block_pools->size(); i++) {
+    ArenaBlockPool* pool = (*block_pools)[i];
+    Cache* cache =
+        &pool->thread_caches_[(me - 1) % pool->options_.num_thread_caches];
+    // The blocks stay in the cache for the next thread that claims it.
+    google::protobuf::internal::Release_CompareAndSwap(&cache->owner, me, 0);
+  }
+}
+
+ArenaBlockPool::~ArenaBlockPool() {
+  {
+    MutexLock lock(block_pool_registry_mutex);
+    block_pools->erase(
+        std::find(block_pools->begin(), block_pools->end(), this));
+  }
+  for (int i = 0; i < options_.num_thread_caches; i++) {
+    FreeAll(&thread_caches_[i]);
+  }
+  FreeAll(global_);
+  delete [] thread_caches_;
+  delete global_;
+}
+
+void ArenaBlockPool::FreeAll(Cache* cache) {
+  for (int size_class = 0; size_class < kNumSizeClasses; size_class++) {
+    void* block;
+    while ((block = Pop(cache, size_class)) != NULL) {
+      options_.block_dealloc(block, static_cast<size_t>(1) << size_class);
+    }
+  }
+}
+
+ArenaBlockPool::Cache* ArenaBlockPool::ThreadCacheForCurrentThread() {
+  Arena::ThreadCache& thread_cache = Arena::thread_cache();
+  if (thread_cache.block_pool_thread_ == 0) {
+    thread_cache.block_pool_thread_ = block_pool_thread_generator.GetNext() + 1;
+#ifdef HAVE_PTHREAD
+    pthread_setspecific(block_pool_thread_key,
+                        reinterpret_cast<void*>(static_cast<intptr_t>(
+                            thread_cache.block_pool_thread_)));
+#endif
+  }
+  google::protobuf::internal::AtomicWord me = thread_cache.block_pool_thread_;
+  Cache* cache = &thread_caches_[(me - 1) % options_.num_thread_caches];
+  google::protobuf::internal::AtomicWord owner =
+      google::protobuf::internal::Acquire_Load(&cache->owner);
+  if (owner == me) return cache;
+  // Claim the cache if nobody has, or its owner has exited and given it up.
+  // Threads that find theirs taken by a live thread share the global list
+  // instead.
+  if (owner == 0 &&
+      google::protobuf::internal::Acquire_CompareAndSwap(&cache->owner, 0, me) == 0) {
+    return cache;
+  }
+  return NULL;
+}
+
+bool ArenaBlockPool::Push(Cache* cache, int size_class, void* block,
+                          int limit) {
+  if (cache->num_blocks[size_class] >= limit) return false;
+  FreeBlock* free_block = reinterpret_cast<FreeBlock*>(block);
+  free_block->next = cache->blocks[size_class];
+  cache->blocks[size_class] = free_block;
+  AddToCounter(&cache->num_blocks[size_class], 1);
+#ifdef ADDRESS_SANITIZER
+  // Catch arenas that keep using memory after handing it back.
+  ASAN_POISON_MEMORY_REGION(
+      reinterpret_cast<char*>(block) + sizeof(FreeBlock),
+      (static_cast<size_t>(1) << size_class) - sizeof(FreeBlock));
+#endif
+  return true;
+}
+
+void* ArenaBlockPool::Pop(Cache* cache, int size_class) {
+  FreeBlock* free_block = cache->blocks[size_class];
+  if (free_block == NULL) return NULL;
+  cache->blocks[size_class] = free_block->next;
+  AddToCounter(&cache->num_blocks[size_class], -1);
+#ifdef ADDRESS_SANITIZER
+  // Blocks are expected to come back unpoisoned, like malloc-ed memory.
+  ASAN_UNPOISON_MEMORY_REGION(free_block, static_cast<size_t>(1) << size_class);
+#endif
+  return free_block;
+}
+
+void* ArenaBlockPool::Allocate(size_t* size, bool* reused) {
+  Cache* cache = ThreadCacheForCurrentThread();
+  int size_class = *size <= options_.max_block_size ? SizeClass(*size) : -1;
+  void* block = NULL;
+  if (size_class >= 0 &&
+      (static_cast<size_t>(1) << size_class) <= options_.max_block_size) {
+    *size = static_cast<size_t>(1) << size_class;
+    if (cache != NULL) {
+      block = Pop(cache, size_class);
+      if (block != NULL) AddToCounter(&cache->hits, 1);
+    }
+    if (block == NULL) {
+      MutexLock lock(&global_->mutex);
+      block = Pop(global_, size_class);
+      if (block != NULL) AddToCounter(&global_->hits, 1);
+    }
+  }
+  *reused = block != NULL;
+  if (block == NULL) {
+    if (cache != NULL) {
+      AddToCounter(&cache->blocks_allocated, 1);
+    } else {
+      MutexLock lock(&global_->mutex);
+      AddToCounter(&global_->blocks_allocated, 1);
+    }
+    block = options_.block_alloc(*size);
+  }
+  return block;
+}
+
+void ArenaBlockPool::Release(void* block, size_t size) {
+  Cache* cache = ThreadCacheForCurrentThread();
+  int size_class = size <= options_.max_block_size ? SizeClass(size) : -1;
+  if (size_class >= 0 && size == static_cast<size_t>(1) << size_class) {
+    if (cache != NULL &&
+        Push(cache, size_class, block, options_.max_thread_cache_blocks)) {
+      return;
+    }
+    // This thread's cache is full; overflow to the global list.
+    MutexLock lock(&global_->mutex);
+    if (Push(global_, size_class, block, options_.max_global_blocks)) {
+      return;
+    }
+    AddToCounter(&global_->blocks_freed, 1);
+  } else if (cache != NULL) {
+    AddToCounter(&cache->blocks_freed, 1);
+  } else {
+    MutexLock lock(&global_->mutex);
+    AddToCounter(&global_->blocks_freed, 1);
+  }
+  options_.block_dealloc(block, size);
+}
+
+void ArenaBlockPool::GetStats(Stats* stats) const {
+  using google::protobuf::internal::NoBarrier_Load;
+  *stats = Stats();
+  for (int i = 0; i <= options_.num_thread_caches; i++) {
+    bool global = i == options_.num_thread_caches;
+    Cache* cache = global ? global_ : &thread_caches_[i];
+    MutexLockMaybe lock(global ? &cache->mutex : NULL);
+    stats->blocks_allocated += NoBarrier_Load(&cache->blocks_allocated);
+    if (global) {
+      stats->global_hits += NoBarrier_Load(&cache->hits);
+    } else {
+      stats->thread_cache_hits += NoBarrier_Load(&cache->hits);
+    }
+    stats->blocks_freed += NoBarrier_Load(&cache->blocks_freed);
+    for (int size_class = 0; size_class < kNumSizeClasses; size_class++) {
+      uint64 num_blocks = NoBarrier_Load(&cache->num_blocks[size_class]);
+      stats->cached_blocks += num_blocks;
+      stats->cached_bytes += num_blocks << size_class;
+    }
+  }
+}
+
 }  // namespace protobuf
 }  // namespace google
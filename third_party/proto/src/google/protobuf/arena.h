@@ -67,6 +67,174 @@ inline void arena_free(void* object, size_t size) {
 
 }  // namespace internal
 
+// Counters describing how an arena has been using memory, accumulated over
+// its whole lifetime (they are not cleared by Arena::Reset()). They are only
+// collected if ArenaOptions::record_stats is set; see Arena::GetStats().
+struct ArenaStats {
+  // Blocks the arena obtained from the system allocator, and blocks it got
+  // back from an ArenaBlockPool instead.
+  uint64 blocks_allocated;
+  uint64 blocks_reused;
+
+  // Blocks released by Reset() or destruction, and the total number of bytes
+  // that were still unused at the end of them.
+  uint64 blocks_freed;
+  uint64 bytes_wasted;
+
+  // Allocations served from the block cached for the allocating thread, and
+  // allocations that had to look elsewhere.
+  uint64 thread_cache_hits;
+  uint64 thread_cache_misses;
+
+  // New blocks started by a thread that had no block of its own in the arena
+  // while another thread's block was current.
+  uint64 cross_thread_allocations;
+
+  ArenaStats()
+      : blocks_allocated(0),
+        blocks_reused(0),
+        blocks_freed(0),
+        bytes_wasted(0),
+        thread_cache_hits(0),
+        thread_cache_misses(0),
+        cross_thread_allocations(0) {}
+
+  double bytes_wasted_per_block() const {
+    return blocks_freed == 0 ? 0.0
+                             : static_cast<double>(bytes_wasted) / blocks_freed;
+  }
+  double thread_cache_hit_rate() const {
+    uint64 total = thread_cache_hits + thread_cache_misses;
+    return total == 0 ? 0.0 : static_cast<double>(thread_cache_hits) / total;
+  }
+};
+
+// A pool of arena blocks that can be shared by many arenas. Arenas created
+// with ArenaOptions::block_pool pointing at a pool take their blocks from it
+// and give them back on Reset() or destruction, instead of calling malloc and
+// free every time. This pays off when arenas are short-lived, e.g. one arena
+// per request.
+//
+// Blocks up to Options::max_block_size are rounded up to a power of two and
+// kept on per-size free lists. Each thread returns blocks to (and takes them
+// from) a cache of its own first, without locking; when that cache is full,
+// blocks overflow to a global list shared by all threads, and beyond that
+// they are freed. Larger blocks are never pooled.
+//
+// A thread keeps its cache until it exits, when the cache and the blocks in
+// it are left for another thread to claim (without pthreads, the cache stays
+// claimed until the pool is destroyed). Threads that find no cache left to
+// claim use the global list only.
+//
+// The pool is thread-safe and must outlive every arena that uses it.
+class LIBPROTOBUF_EXPORT ArenaBlockPool {
+ public:
+  struct Options {
+    // Largest block size that is pooled.
+    size_t max_block_size;
+
+    // Number of per-thread caches.
+    int num_thread_caches;
+
+    // Maximum number of blocks of each size kept in each per-thread cache,
+    // and in the global list.
+    int max_thread_cache_blocks;
+    int max_global_blocks;
+
+    // Used to allocate blocks that are not in the pool and to free blocks that
+    // do not fit into it. These default to malloc and free; see the matching
+    // fields of ArenaOptions.
+    void* (*block_alloc)(size_t);
+    void (*block_dealloc)(void*, size_t);
+
+    Options()
+        : max_block_size(kDefaultMaxBlockSize),
+          num_thread_caches(kDefaultNumThreadCaches),
+          max_thread_cache_blocks(kDefaultMaxThreadCacheBlocks),
+          max_global_blocks(kDefaultMaxGlobalBlocks),
+          block_alloc(&malloc),
+          block_dealloc(&internal::arena_free) {}
+
+   private:
+    static const size_t kDefaultMaxBlockSize = 64 * 1024;
+    static const int kDefaultNumThreadCaches = 16;
+    static const int kDefaultMaxThreadCacheBlocks = 16;
+    static const int kDefaultMaxGlobalBlocks = 64;
+  };
+
+  struct Stats {
+    // Blocks handed out: newly allocated ones, and ones reused from the
+    // requesting thread's cache or from the global list.
+    uint64 blocks_allocated;
+    uint64 thread_cache_hits;
+    uint64 global_hits;
+
+    // Blocks given back that were freed because they were too large or
+    // because the caches were full.
+    uint64 blocks_freed;
+
+    // Blocks and bytes currently held by the pool.
+    uint64 cached_blocks;
+    uint64 cached_bytes;
+
+    Stats()
+        : blocks_allocated(0),
+          thread_cache_hits(0),
+          global_hits(0),
+          blocks_freed(0),
+          cached_blocks(0),
+          cached_bytes(0) {}
+
+    double thread_cache_hit_rate() const {
+      uint64 total = blocks_allocated + thread_cache_hits + global_hits;
+      return total == 0 ? 0.0 : static_cast<double>(thread_cache_hits) / total;
+    }
+  };
+
+  ArenaBlockPool();
+  explicit ArenaBlockPool(const Options& options);
+  // Frees all blocks held by the pool.
+  ~ArenaBlockPool();
+
+  // Fills in *stats. Safe to call while other threads use the pool.
+  void GetStats(Stats* stats) const;
+
+ private:
+  friend class Arena;
+
+  struct FreeBlock;
+  struct Cache;
+
+  void Init();
+
+  // Sets up the list of live pools, which ThreadExited() goes through.
+  static void InitRegistry();
+  // Gives up the caches that an exiting thread claimed in every pool.
+  // thread is the thread's Arena::ThreadCache::block_pool_thread_.
+  static void ThreadExited(void* thread);
+
+  // Returns a block of at least *size bytes and sets *size to its actual
+  // size. Sets *reused to whether it came from the pool.
+  void* Allocate(size_t* size, bool* reused);
+  // Takes back a block returned by Allocate(); size is the value Allocate()
+  // stored in *size.
+  void Release(void* block, size_t size);
+
+  // Returns the cache owned by the calling thread, claiming one if needed, or
+  // NULL if none is available.
+  Cache* ThreadCacheForCurrentThread();
+
+  static bool Push(Cache* cache, int size_class, void* block, int limit);
+  static void* Pop(Cache* cache, int size_class);
+  void FreeAll(Cache* cache);
+
+  Options options_;
+  Cache* thread_caches_;  // options_.num_thread_caches of them
+  Cache* global_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ArenaBlockPool);
+};
+
 // ArenaOptions provides optional additional parameters to arena construction
 // that control its block-allocation behavior.
 struct ArenaOptions {
@@ -100,6 +268,15 @@ struct ArenaOptions {
   // calls free.
   void (*block_dealloc)(void*, size_t);
 
+  // A pool to take blocks from and return them to, or NULL for none. If set,
+  // block_alloc and block_dealloc are not used; the pool's own functions are.
+  // The pool must outlive the arena.
+  ArenaBlockPool* block_pool;
+
+  // Whether to collect the counters returned by Arena::GetStats(). This costs
+  // an atomic increment on every allocation.
+  bool record_stats;
+
   // Hooks for adding external functionality such as user-specific metrics
   // collection, specific debugging abilities, etc.
   // Init hook may return a pointer to a cookie to be stored in the arena.
@@ -128,6 +305,8 @@ struct ArenaOptions {
         initial_block_size(0),
         block_alloc(&malloc),
         block_dealloc(&internal::arena_free),
+        block_pool(NULL),
+        record_stats(false),
         on_arena_init(NULL),
         on_arena_reset(NULL),
         on_arena_destruction(NULL),
@@ -428,6 +607,10 @@ class LIBPROTOBUF_EXPORT Arena {
   // As above, but does not include any free space in underlying blocks.
   uint64 SpaceUsed() const GOOGLE_ATTRIBUTE_NOINLINE;
 
+  // Fills in *stats with the counters collected since the arena was created.
+  // All counters are zero unless ArenaOptions::record_stats was set.
+  void GetStats(ArenaStats* stats) const;
+
   // Frees all storage allocated by this arena after calling destructors
   // registered with OwnDestructor() and freeing objects registered with Own().
   // Any objects allocated on this arena are unusable after this call. It also
@@ -511,6 +694,7 @@ class LIBPROTOBUF_EXPORT Arena {
   };
 
   template<typename Type> friend class ::google::protobuf::internal::GenericTypeHandler;
+  friend class ArenaBlockPool;         // For thread_cache().
   friend class MockArena;              // For unit-testing.
   friend class internal::ArenaString;  // For AllocateAligned.
   friend class internal::LazyField;    // For CreateMaybeMessage.
@@ -520,6 +704,9 @@ class LIBPROTOBUF_EXPORT Arena {
     // lifecycle_id of the arena being used.
     int64 last_lifecycle_id_seen;
     Block* last_block_used_;
+    // One plus the index of this thread among the threads that have used an
+    // ArenaBlockPool, or 0 if it has not used one yet.
+    int64 block_pool_thread_;
   };
 
   static const size_t kHeaderSize = sizeof(Block);
@@ -808,6 +995,9 @@ class LIBPROTOBUF_EXPORT Arena {
     thread_cache().last_lifecycle_id_seen = lifecycle_id_;
   }
 
+  // Returns a block to the pool or the system allocator.
+  void ReleaseBlock(Block* b);
+
   int64 lifecycle_id_;  // Unique for each arena. Changes on Reset().
 
   google::protobuf::internal::AtomicWord blocks_;  // Head of linked list of all allocated blocks
@@ -840,6 +1030,25 @@ class LIBPROTOBUF_EXPORT Arena {
   // and then use it when calling the on_reset and on_destruction hooks.
   void* hooks_cookie_;
 
+  // Atomic counterparts of the ArenaStats fields, or NULL if
+  // options_.record_stats is not set.
+  struct StatsCounters {
+    google::protobuf::internal::AtomicWord blocks_allocated;
+    google::protobuf::internal::AtomicWord blocks_reused;
+    google::protobuf::internal::AtomicWord blocks_freed;
+    google::protobuf::internal::AtomicWord bytes_wasted;
+    google::protobuf::internal::AtomicWord thread_cache_hits;
+    google::protobuf::internal::AtomicWord thread_cache_misses;
+    google::protobuf::internal::AtomicWord cross_thread_allocations;
+  };
+  StatsCounters* stats_;
+
+  static void IncrementCounter(google::protobuf::internal::AtomicWord* counter,
+                               size_t amount) {
+    google::protobuf::internal::NoBarrier_AtomicIncrement(
+        counter, static_cast<google::protobuf::internal::AtomicWord>(amount));
+  }
+
   ArenaOptions options_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(Arena);
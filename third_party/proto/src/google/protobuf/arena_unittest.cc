@@ -30,6 +30,10 @@
 
 #include <google/protobuf/arena.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #include <algorithm>
 #include <cstring>
 #include <memory>
@@ -1243,5 +1247,293 @@ TEST(ArenaTest, ArenaHooksSanity) {
   EXPECT_EQ(1, ArenaHooksTestUtil::num_destruct);
 }
 
+TEST(ArenaTest, BlockPoolReusesBlocks) {
+  ArenaBlockPool pool;
+  ArenaOptions options;
+  options.block_pool = &pool;
+  options.record_stats = true;
+  Arena arena(options);
+  ::google::protobuf::Arena::CreateArray<char>(&arena, 320);
+  uint64 space_allocated = arena.SpaceAllocated();
+  EXPECT_EQ(space_allocated, arena.Reset());
+
+  ArenaBlockPool::Stats pool_stats;
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(1, pool_stats.blocks_allocated);
+  EXPECT_EQ(1, pool_stats.cached_blocks);
+  EXPECT_EQ(space_allocated, pool_stats.cached_bytes);
+
+  ::google::protobuf::Arena::CreateArray<char>(&arena, 320);
+  EXPECT_EQ(space_allocated, arena.SpaceAllocated());
+  EXPECT_EQ(Align8(320), arena.SpaceUsed());
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(1, pool_stats.blocks_allocated);
+  EXPECT_EQ(1, pool_stats.thread_cache_hits);
+  EXPECT_EQ(0, pool_stats.cached_blocks);
+
+  ArenaStats stats;
+  arena.GetStats(&stats);
+  EXPECT_EQ(1, stats.blocks_allocated);
+  EXPECT_EQ(1, stats.blocks_reused);
+  EXPECT_EQ(1, stats.blocks_freed);
+  EXPECT_GT(stats.bytes_wasted, 0);
+  EXPECT_LT(stats.bytes_wasted, space_allocated - Align8(320));
+}
+
+TEST(ArenaTest, BlockPoolOverflowsToGlobalList) {
+  ArenaBlockPool::Options pool_options;
+  pool_options.max_thread_cache_blocks = 1;
+  pool_options.max_global_blocks = 1;
+  ArenaBlockPool pool(pool_options);
+  ArenaOptions options;
+  options.start_block_size = 1024;
+  options.max_block_size = 1024;
+  options.block_pool = &pool;
+  {
+    Arena arena(options);
+    for (int i = 0; i < 3; i++) {
+      ::google::protobuf::Arena::CreateArray<char>(&arena, 900);
+    }
+    EXPECT_EQ(3 * 1024, arena.SpaceAllocated());
+  }
+  ArenaBlockPool::Stats pool_stats;
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(3, pool_stats.blocks_allocated);
+  EXPECT_EQ(1, pool_stats.blocks_freed);
+  EXPECT_EQ(2, pool_stats.cached_blocks);
+  EXPECT_EQ(2 * 1024, pool_stats.cached_bytes);
+
+  {
+    Arena arena(options);
+    for (int i = 0; i < 3; i++) {
+      ::google::protobuf::Arena::CreateArray<char>(&arena, 900);
+    }
+  }
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(4, pool_stats.blocks_allocated);
+  EXPECT_EQ(1, pool_stats.thread_cache_hits);
+  EXPECT_EQ(1, pool_stats.global_hits);
+  EXPECT_EQ(2, pool_stats.blocks_freed);
+}
+
+TEST(ArenaTest, BlockPoolRoundsUpAndSkipsLargeBlocks) {
+  ArenaBlockPool::Options pool_options;
+  pool_options.max_block_size = 4096;
+  ArenaBlockPool pool(pool_options);
+  ArenaOptions options;
+  options.start_block_size = 200;
+  options.block_pool = &pool;
+  {
+    Arena arena(options);
+    ::google::protobuf::Arena::CreateArray<char>(&arena, 100);
+    EXPECT_EQ(256, arena.SpaceAllocated());
+    // Too large for the pool.
+    ::google::protobuf::Arena::CreateArray<char>(&arena, 5000);
+    EXPECT_LE(256 + 5000, arena.SpaceAllocated());
+  }
+  ArenaBlockPool::Stats pool_stats;
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(2, pool_stats.blocks_allocated);
+  EXPECT_EQ(1, pool_stats.blocks_freed);
+  EXPECT_EQ(1, pool_stats.cached_blocks);
+  EXPECT_EQ(256, pool_stats.cached_bytes);
+}
+
+TEST(ArenaTest, BlockPoolWithInitialBlock) {
+  ArenaBlockPool pool;
+  std::vector<char> arena_block(1024);
+  ArenaOptions options;
+  options.initial_block = &arena_block[0];
+  options.initial_block_size = arena_block.size();
+  options.block_pool = &pool;
+  {
+    Arena arena(options);
+    ::google::protobuf::Arena::CreateArray<char>(&arena, 2000);
+    EXPECT_LE(1024 + 2000, arena.SpaceAllocated());
+    arena.Reset();
+    EXPECT_EQ(1024, arena.SpaceAllocated());
+  }
+  // The initial block belongs to the caller and must not end up in the pool.
+  ArenaBlockPool::Stats pool_stats;
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(1, pool_stats.cached_blocks);
+}
+
+TEST(ArenaTest, Stats) {
+  ArenaOptions options;
+  options.start_block_size = 256;
+  options.max_block_size = 256;
+  options.record_stats = true;
+  Arena arena(options);
+  ArenaStats stats;
+  arena.GetStats(&stats);
+  EXPECT_EQ(0, stats.blocks_allocated);
+  EXPECT_EQ(0.0, stats.thread_cache_hit_rate());
+  EXPECT_EQ(0.0, stats.bytes_wasted_per_block());
+
+  for (int i = 0; i < 3; i++) {
+    ::google::protobuf::Arena::CreateArray<char>(&arena, 200);
+  }
+  uint64 unused = arena.SpaceAllocated() - arena.SpaceUsed();
+  arena.Reset();
+  arena.GetStats(&stats);
+  // Every allocation needed a new block.
+  EXPECT_EQ(3, stats.blocks_allocated);
+  EXPECT_EQ(0, stats.blocks_reused);
+  EXPECT_EQ(3, stats.blocks_freed);
+  // Apart from the block headers, the unused space is what was wasted.
+  EXPECT_GT(stats.bytes_wasted, 0);
+  EXPECT_LT(stats.bytes_wasted, unused);
+  EXPECT_EQ(0, (unused - stats.bytes_wasted) % 3);
+  EXPECT_EQ(stats.bytes_wasted / 3.0, stats.bytes_wasted_per_block());
+  EXPECT_EQ(0, stats.cross_thread_allocations);
+
+  for (int i = 0; i < 5; i++) {
+    ::google::protobuf::Arena::CreateArray<char>(&arena, 8);
+  }
+  arena.GetStats(&stats);
+  EXPECT_EQ(4, stats.blocks_allocated);
+  EXPECT_EQ(4, stats.thread_cache_hits);
+  EXPECT_EQ(4, stats.thread_cache_misses);
+  EXPECT_EQ(0.5, stats.thread_cache_hit_rate());
+
+  // Nothing is recorded by default.
+  Arena plain_arena;
+  ::google::protobuf::Arena::CreateArray<char>(&plain_arena, 8);
+  plain_arena.GetStats(&stats);
+  EXPECT_EQ(0, stats.blocks_allocated);
+  EXPECT_EQ(0, stats.thread_cache_misses);
+}
+
+#ifndef _WIN32
+namespace {
+
+// Simulates a server that handles each request on an arena of its own:
+// every iteration makes a few dozen allocations of assorted sizes and then
+// throws the arena away, either by destroying it or by resetting it.
+// benchmarks/arena_bench.cc times the same loop.
+struct ArenaWorkload {
+  ArenaOptions options;
+  bool reuse_arena;
+  Arena* shared_arena;  // If set, all threads allocate from this arena.
+  int iterations;
+
+  static void* Run(void* arg) {
+    const ArenaWorkload* workload = static_cast<ArenaWorkload*>(arg);
+    Arena arena(workload->options);
+    uint32 seed = 1;
+    for (int i = 0; i < workload->iterations; i++) {
+      Arena* request_arena = workload->shared_arena;
+      scoped_ptr<Arena> new_arena;
+      if (request_arena == NULL) {
+        if (workload->reuse_arena) {
+          request_arena = &arena;
+        } else {
+          new_arena.reset(new Arena(workload->options));
+          request_arena = new_arena.get();
+        }
+      }
+      for (int j = 0; j < 64; j++) {
+        seed = seed * 1103515245 + 12345;
+        char* p =
+            Arena::CreateArray<char>(request_arena, 1 + (seed >> 16) % 512);
+        p[0] = 1;
+      }
+      if (workload->reuse_arena && workload->shared_arena == NULL) {
+        arena.Reset();
+      }
+    }
+    return NULL;
+  }
+
+  void RunThreads(int num_threads) {
+    std::vector<pthread_t> threads(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+      pthread_create(&threads[i], NULL, &Run, this);
+    }
+    for (int i = 0; i < num_threads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+};
+
+}  // namespace
+
+TEST(ArenaTest, BlockPoolThreads) {
+  const int kThreads = 4;
+  for (int reuse_arena = 0; reuse_arena < 2; reuse_arena++) {
+    ArenaBlockPool pool;
+    ArenaWorkload workload;
+    workload.options.block_pool = &pool;
+    workload.reuse_arena = reuse_arena;
+    workload.shared_arena = NULL;
+    workload.iterations = 200;
+    workload.RunThreads(kThreads);
+    ArenaBlockPool::Stats pool_stats;
+    pool.GetStats(&pool_stats);
+    // Only the first few requests of each thread allocate new blocks.
+    EXPECT_LT(pool_stats.blocks_allocated,
+              pool_stats.thread_cache_hits + pool_stats.global_hits);
+  }
+}
+
+TEST(ArenaTest, StatsWithSharedArena) {
+  const int kThreads = 4;
+  ArenaOptions options;
+  options.record_stats = true;
+  Arena shared_arena(options);
+  // Make the arena's first block belong to this thread, so that the first
+  // workload thread to run allocates across threads.
+  Arena::CreateArray<char>(&shared_arena, 8);
+  ArenaWorkload workload;
+  workload.reuse_arena = false;
+  workload.shared_arena = &shared_arena;
+  workload.iterations = 100;
+  workload.RunThreads(kThreads);
+  ArenaStats stats;
+  shared_arena.GetStats(&stats);
+  EXPECT_EQ(kThreads * 100 * 64 + 1,
+            stats.thread_cache_hits + stats.thread_cache_misses);
+  EXPECT_LT(0, stats.cross_thread_allocations);
+  shared_arena.Reset();
+  shared_arena.GetStats(&stats);
+  EXPECT_EQ(stats.blocks_allocated, stats.blocks_freed);
+}
+
+namespace {
+
+void* AllocateFromPool(void* pool) {
+  ArenaOptions options;
+  options.block_pool = static_cast<ArenaBlockPool*>(pool);
+  Arena arena(options);
+  Arena::CreateArray<char>(&arena, 100);
+  return NULL;
+}
+
+}  // namespace
+
+TEST(ArenaTest, BlockPoolReclaimsCachesOfExitedThreads) {
+  ArenaBlockPool::Options pool_options;
+  pool_options.num_thread_caches = 1;
+  pool_options.max_global_blocks = 0;
+  ArenaBlockPool pool(pool_options);
+  // The thread leaves its block in the only thread cache and exits.
+  pthread_t thread;
+  pthread_create(&thread, NULL, &AllocateFromPool, &pool);
+  pthread_join(thread, NULL);
+  ArenaBlockPool::Stats pool_stats;
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(1, pool_stats.cached_blocks);
+
+  // This thread takes over the cache, block included.
+  AllocateFromPool(&pool);
+  pool.GetStats(&pool_stats);
+  EXPECT_EQ(1, pool_stats.blocks_allocated);
+  EXPECT_EQ(1, pool_stats.thread_cache_hits);
+  EXPECT_EQ(0, pool_stats.blocks_freed);
+  EXPECT_EQ(1, pool_stats.cached_blocks);
+}
+#endif  // !_WIN32
+
 }  // namespace protobuf
 }  // namespace google
@@ -38,6 +38,16 @@
 #if HAVE_ZLIB
 #include <google/protobuf/io/gzip_stream.h>
 
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
 #include <google/protobuf/stubs/common.h>
 
 namespace google {
@@ -46,9 +56,68 @@ namespace io {
 
 static const int kDefaultBufferSize = 65536;
 
+#ifdef HAVE_PTHREAD
+// The buffers of a GzipInputStream that reads ahead.  The background thread
+// takes free buffers, inflates into them and queues them as chunks.  The
+// caller hands a chunk's buffer back once it moves on to the next chunk.
+struct GzipInputStream::ReadAhead {
+  struct Chunk {
+    void* buffer;
+    const void* data;
+    int size;
+    // False at the end of the stream or on an error.
+    bool ok;
+    // zcontext_.msg and zerror_ after inflating the chunk.
+    const char* msg;
+    int zerror;
+  };
+
+  explicit ReadAhead(int num_buffers)
+      : started(false), stop(false), position(0), byte_count(0) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&buffer_free, NULL);
+    pthread_cond_init(&chunk_ready, NULL);
+    current.buffer = NULL;
+    current.data = NULL;
+    current.size = 0;
+    current.ok = true;
+    current.msg = NULL;
+    current.zerror = Z_OK;
+    buffers.reserve(num_buffers);
+  }
+  ~ReadAhead() {
+    pthread_cond_destroy(&chunk_ready);
+    pthread_cond_destroy(&buffer_free);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  // All buffers, including the stream's original output_buffer_.
+  std::vector<void*> buffers;
+
+  pthread_t thread;
+  bool started;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t buffer_free;
+  pthread_cond_t chunk_ready;
+  // Guarded by mutex.
+  std::vector<void*> free_buffers;
+  std::deque<Chunk> chunks;
+  bool stop;
+
+  // Only used by the caller: the chunk being read, how much of it was
+  // returned by Next() and the number of bytes returned in all.
+  Chunk current;
+  int position;
+  int64 byte_count;
+};
+#endif  // HAVE_PTHREAD
+
 GzipInputStream::GzipInputStream(
-    ZeroCopyInputStream* sub_stream, Format format, int buffer_size)
-    : format_(format), sub_stream_(sub_stream), zerror_(Z_OK), byte_count_(0) {
+    ZeroCopyInputStream* sub_stream, Format format, int buffer_size,
+    int read_ahead_buffers)
+    : format_(format), sub_stream_(sub_stream), zerror_(Z_OK), byte_count_(0),
+      read_ahead_(NULL), read_ahead_msg_(NULL), read_ahead_zerror_(Z_OK) {
   zcontext_.state = Z_NULL;
   zcontext_.zalloc = Z_NULL;
   zcontext_.zfree = Z_NULL;
@@ -68,9 +137,39 @@ GzipInputStream::GzipInputStream(
   zcontext_.next_out = static_cast<Bytef*>(output_buffer_);
   zcontext_.avail_out = output_buffer_length_;
   output_position_ = output_buffer_;
+#ifdef HAVE_PTHREAD
+  if (read_ahead_buffers > 0) {
+    // One more buffer for the caller and one for the background thread.
+    int num_buffers = read_ahead_buffers + 2;
+    read_ahead_ = new ReadAhead(num_buffers);
+    read_ahead_->buffers.push_back(output_buffer_);
+    for (int i = 1; i < num_buffers; i++) {
+      read_ahead_->buffers.push_back(operator new(output_buffer_length_));
+    }
+    read_ahead_->free_buffers = read_ahead_->buffers;
+  }
+#endif
 }
 GzipInputStream::~GzipInputStream() {
+#ifdef HAVE_PTHREAD
+  if (read_ahead_ != NULL) {
+    pthread_mutex_lock(&read_ahead_->mutex);
+    read_ahead_->stop = true;
+    pthread_cond_signal(&read_ahead_->buffer_free);
+    pthread_mutex_unlock(&read_ahead_->mutex);
+    if (read_ahead_->started) {
+      pthread_join(read_ahead_->thread, NULL);
+    }
+    for (size_t i = 0; i < read_ahead_->buffers.size(); i++) {
+      operator delete(read_ahead_->buffers[i]);
+    }
+    delete read_ahead_;
+  } else {
+    operator delete(output_buffer_);
+  }
+#else
   operator delete(output_buffer_);
+#endif
   zerror_ = inflateEnd(&zcontext_);
 }
 
@@ -120,8 +219,7 @@ void GzipInputStream::DoNextOutput(const void** data, int* size) {
   output_position_ = zcontext_.next_out;
 }
 
-// implements ZeroCopyInputStream ----------------------------------
-bool GzipInputStream::Next(const void** data, int* size) {
+bool GzipInputStream::InflateNext(const void** data, int* size) {
   bool ok = (zerror_ == Z_OK) || (zerror_ == Z_STREAM_END)
       || (zerror_ == Z_BUF_ERROR);
   if ((!ok) || (zcontext_.next_out == NULL)) {
@@ -162,7 +260,106 @@ bool GzipInputStream::Next(const void** data, int* size) {
   DoNextOutput(data, size);
   return true;
 }
+
+#ifdef HAVE_PTHREAD
+void* GzipInputStream::ReadAheadThread(void* stream) {
+  static_cast<GzipInputStream*>(stream)->ReadAheadLoop();
+  return NULL;
+}
+
+void GzipInputStream::ReadAheadLoop() {
+  ReadAhead* read_ahead = read_ahead_;
+  while (true) {
+    pthread_mutex_lock(&read_ahead->mutex);
+    while (read_ahead->free_buffers.empty() && !read_ahead->stop) {
+      pthread_cond_wait(&read_ahead->buffer_free, &read_ahead->mutex);
+    }
+    if (read_ahead->stop) {
+      pthread_mutex_unlock(&read_ahead->mutex);
+      return;
+    }
+    ReadAhead::Chunk chunk;
+    chunk.buffer = read_ahead->free_buffers.back();
+    read_ahead->free_buffers.pop_back();
+    pthread_mutex_unlock(&read_ahead->mutex);
+
+    // Inflate() always starts filling output_buffer_, and the data
+    // InflateNext() returns doesn't depend on earlier output, so every
+    // chunk can go to a different buffer.
+    output_buffer_ = chunk.buffer;
+    chunk.ok = InflateNext(&chunk.data, &chunk.size);
+    chunk.msg = zcontext_.msg;
+    chunk.zerror = zerror_;
+
+    pthread_mutex_lock(&read_ahead->mutex);
+    read_ahead->chunks.push_back(chunk);
+    pthread_cond_signal(&read_ahead->chunk_ready);
+    pthread_mutex_unlock(&read_ahead->mutex);
+    if (!chunk.ok) {
+      return;
+    }
+  }
+}
+
+bool GzipInputStream::ReadAheadNext(const void** data, int* size) {
+  ReadAhead* read_ahead = read_ahead_;
+  ReadAhead::Chunk* current = &read_ahead->current;
+  if (read_ahead->position == current->size) {
+    if (!current->ok) {
+      return false;
+    }
+    if (!read_ahead->started) {
+      if (pthread_create(&read_ahead->thread, NULL, &ReadAheadThread, this)
+          != 0) {
+        GOOGLE_LOG(FATAL) << "pthread_create failed";
+      }
+      read_ahead->started = true;
+    }
+    pthread_mutex_lock(&read_ahead->mutex);
+    if (current->buffer != NULL) {
+      read_ahead->free_buffers.push_back(current->buffer);
+      pthread_cond_signal(&read_ahead->buffer_free);
+    }
+    while (read_ahead->chunks.empty()) {
+      pthread_cond_wait(&read_ahead->chunk_ready, &read_ahead->mutex);
+    }
+    *current = read_ahead->chunks.front();
+    read_ahead->chunks.pop_front();
+    read_ahead_msg_ = current->msg;
+    read_ahead_zerror_ = current->zerror;
+    pthread_mutex_unlock(&read_ahead->mutex);
+    read_ahead->position = 0;
+    if (!current->ok) {
+      current->size = 0;
+      return false;
+    }
+  }
+  *data = static_cast<const uint8*>(current->data) + read_ahead->position;
+  *size = current->size - read_ahead->position;
+  read_ahead->position = current->size;
+  read_ahead->byte_count += *size;
+  return true;
+}
+#endif  // HAVE_PTHREAD
+
+// implements ZeroCopyInputStream ----------------------------------
+bool GzipInputStream::Next(const void** data, int* size) {
+#ifdef HAVE_PTHREAD
+  if (read_ahead_ != NULL) {
+    return ReadAheadNext(data, size);
+  }
+#endif
+  return InflateNext(data, size);
+}
 void GzipInputStream::BackUp(int count) {
+#ifdef HAVE_PTHREAD
+  if (read_ahead_ != NULL) {
+    GOOGLE_CHECK_GE(read_ahead_->position, count);
+    read_ahead_->position -= count;
+    read_ahead_->byte_count -= count;
+    return;
+  }
+#endif
   output_position_ = reinterpret_cast<void*>(
       reinterpret_cast<uintptr_t>(output_position_) - count);
 }
@@ -180,6 +377,11 @@ bool GzipInputStream::Skip(int count) {
   return ok;
 }
 int64 GzipInputStream::ByteCount() const {
+#ifdef HAVE_PTHREAD
+  if (read_ahead_ != NULL) {
+    return read_ahead_->byte_count;
+  }
+#endif
   int64 ret = byte_count_ + zcontext_.total_out;
   if (zcontext_.next_out != NULL && output_position_ != NULL) {
     ret += reinterpret_cast<uintptr_t>(zcontext_.next_out) -
@@ -190,11 +392,157 @@ int64 GzipInputStream::ByteCount() const {
 
 // =========================================================================
 
+namespace {
+
+// Size of the deflate window, and so of the dictionary a block is primed
+// with.
+const int kWindowSize = 32768;
+
+// A block of input that is compressed on its own.
+struct Block {
+  string input;
+  // Up to kWindowSize bytes of input preceding this block.
+  string dictionary;
+  // Raw deflate data, ending on a byte boundary.
+  string output;
+  // The crc32 (for gzip) or adler32 (for zlib) of input.
+  uLong check;
+  // Whether this block ends the stream.
+  bool last;
+  bool done;
+  int error;
+};
+
+// Compresses block with zcontext, a raw deflate stream.
+void CompressBlock(z_stream* zcontext, GzipOutputStream::Format format,
+                   Block* block) {
+  const Bytef* input = reinterpret_cast<const Bytef*>(block->input.data());
+  uInt input_size = block->input.size();
+  block->check = format == GzipOutputStream::GZIP
+      ? crc32(crc32(0L, Z_NULL, 0), input, input_size)
+      : adler32(adler32(0L, Z_NULL, 0), input, input_size);
+
+  int error = deflateReset(zcontext);
+  if (error == Z_OK && !block->dictionary.empty()) {
+    error = deflateSetDictionary(
+        zcontext, reinterpret_cast<const Bytef*>(block->dictionary.data()),
+        block->dictionary.size());
+  }
+  zcontext->next_in = const_cast<Bytef*>(input);
+  zcontext->avail_in = input_size;
+  // Finish the last block.  Flush the others to a byte boundary, so that
+  // the next one can simply be appended.
+  int flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+  // The flush marker adds a few bytes to deflateBound().
+  block->output.resize(deflateBound(zcontext, input_size) + 16);
+  size_t output_size = 0;
+  while (error == Z_OK) {
+    if (output_size == block->output.size()) {
+      block->output.resize(block->output.size() * 2);
+    }
+    zcontext->next_out =
+        reinterpret_cast<Bytef*>(&block->output[output_size]);
+    zcontext->avail_out = block->output.size() - output_size;
+    error = deflate(zcontext, flush);
+    output_size = block->output.size() - zcontext->avail_out;
+    if (error == Z_OK && zcontext->avail_out != 0) {
+      break;
+    }
+  }
+  if (error == Z_STREAM_END) {
+    error = Z_OK;
+  }
+  block->output.resize(output_size);
+  block->error = error;
+}
+
+}  // namespace
+
+// The blocks of a GzipOutputStream compressing with several threads.  Next()
+// hands out the input of the current block.  Full blocks are queued for the
+// compressing threads and kept in pending until they are written, in order,
+// by the calling thread.
+struct GzipOutputStream::Parallel {
+  explicit Parallel(const Options& options)
+      : format(options.format),
+        compression_level(options.compression_level),
+        compression_strategy(options.compression_strategy),
+        num_threads(options.num_threads),
+        stop(false),
+        current(NULL),
+        current_size(0),
+        total_in(0),
+        header_written(false) {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&block_queued, NULL);
+    pthread_cond_init(&block_done, NULL);
+#endif
+    check = format == GZIP ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+  }
+  ~Parallel() {
+#ifdef HAVE_PTHREAD
+    Lock();
+    stop = true;
+    pthread_cond_broadcast(&block_queued);
+    Unlock();
+    for (size_t i = 0; i < threads.size(); i++) {
+      pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&block_done);
+    pthread_cond_destroy(&block_queued);
+    pthread_mutex_destroy(&mutex);
+#endif
+    for (size_t i = 0; i < blocks.size(); i++) {
+      delete blocks[i];
+    }
+  }
+
+  void Lock() {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&mutex);
+#endif
+  }
+  void Unlock() {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&mutex);
+#endif
+  }
+
+  const Format format;
+  const int compression_level;
+  const int compression_strategy;
+  const int num_threads;
+
+#ifdef HAVE_PTHREAD
+  std::vector<pthread_t> threads;
+  pthread_mutex_t mutex;
+  pthread_cond_t block_queued;
+  pthread_cond_t block_done;
+#endif
+  // Guarded by mutex.
+  std::deque<Block*> queue;
+  bool stop;
+
+  // Only used by the calling thread.
+  std::vector<Block*> blocks;
+  std::vector<Block*> free_blocks;
+  std::deque<Block*> pending;
+  Block* current;
+  int current_size;
+  // The last kWindowSize bytes of input that were submitted.
+  string window;
+  uLong check;
+  int64 total_in;
+  bool header_written;
+};
+
 GzipOutputStream::Options::Options()
     : format(GZIP),
       buffer_size(kDefaultBufferSize),
       compression_level(Z_DEFAULT_COMPRESSION),
-      compression_strategy(Z_DEFAULT_STRATEGY) {}
+      compression_strategy(Z_DEFAULT_STRATEGY),
+      num_threads(1) {}
 
 GzipOutputStream::GzipOutputStream(ZeroCopyOutputStream* sub_stream) {
   Init(sub_stream, Options());
@@ -212,8 +560,15 @@ void GzipOutputStream::Init(ZeroCopyOutputStream* sub_stream,
   sub_data_size_ = 0;
 
   input_buffer_length_ = options.buffer_size;
-  input_buffer_ = operator new(input_buffer_length_);
-  GOOGLE_CHECK(input_buffer_ != NULL);
+  parallel_ = NULL;
+  if (options.num_threads > 1) {
+    // Blocks provide the input buffers.
+    input_buffer_ = NULL;
+    parallel_ = new Parallel(options);
+  } else {
+    input_buffer_ = operator new(input_buffer_length_);
+    GOOGLE_CHECK(input_buffer_ != NULL);
+  }
 
   zcontext_.zalloc = Z_NULL;
   zcontext_.zfree = Z_NULL;
@@ -225,6 +580,27 @@ void GzipOutputStream::Init(ZeroCopyOutputStream* sub_stream,
   zcontext_.avail_in = 0;
   zcontext_.total_in = 0;
   zcontext_.msg = NULL;
+  if (parallel_ != NULL) {
+    // zcontext_ compresses blocks on the calling thread, without a header.
+    zerror_ = deflateInit2(
+        &zcontext_,
+        options.compression_level,
+        Z_DEFLATED,
+        /* windowBits */-15,
+        /* memLevel (default) */8,
+        options.compression_strategy);
+#ifdef HAVE_PTHREAD
+    for (int i = 1; i < options.num_threads; i++) {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, &CompressThread, parallel_) != 0) {
+        // The calling thread compresses whatever is left over.
+        break;
+      }
+      parallel_->threads.push_back(thread);
+    }
+#endif
+    return;
+  }
   // default to GZIP format
   int windowBitsFormat = 16;
   if (options.format == ZLIB) {
@@ -241,6 +617,7 @@ void GzipOutputStream::Init(ZeroCopyOutputStream* sub_stream,
 
 GzipOutputStream::~GzipOutputStream() {
   Close();
+  delete parallel_;
   if (input_buffer_ != NULL) {
     operator delete(input_buffer_);
   }
@@ -273,8 +650,231 @@ int GzipOutputStream::Deflate(int flush) {
   return error;
 }
 
+#ifdef HAVE_PTHREAD
+void* GzipOutputStream::CompressThread(void* parallel) {
+  Parallel* p = static_cast<Parallel*>(parallel);
+  z_stream zcontext;
+  zcontext.zalloc = Z_NULL;
+  zcontext.zfree = Z_NULL;
+  zcontext.opaque = Z_NULL;
+  int error = deflateInit2(
+      &zcontext, p->compression_level, Z_DEFLATED, /* windowBits */-15,
+      /* memLevel (default) */8, p->compression_strategy);
+  p->Lock();
+  while (true) {
+    while (p->queue.empty() && !p->stop) {
+      pthread_cond_wait(&p->block_queued, &p->mutex);
+    }
+    if (p->queue.empty()) {
+      break;
+    }
+    Block* block = p->queue.front();
+    p->queue.pop_front();
+    p->Unlock();
+    if (error == Z_OK) {
+      CompressBlock(&zcontext, p->format, block);
+    } else {
+      block->error = error;
+    }
+    p->Lock();
+    block->done = true;
+    pthread_cond_signal(&p->block_done);
+  }
+  p->Unlock();
+  if (error == Z_OK) {
+    deflateEnd(&zcontext);
+  }
+  return NULL;
+}
+#endif  // HAVE_PTHREAD
+
+void GzipOutputStream::SubmitBlock(bool last) {
+  Parallel* p = parallel_;
+  Block* block = p->current;
+  if (block == NULL) {
+    if (p->free_blocks.empty()) {
+      p->blocks.push_back(new Block);
+      p->free_blocks.push_back(p->blocks.back());
+    }
+    block = p->free_blocks.back();
+    p->free_blocks.pop_back();
+  }
+  block->input.resize(p->current_size);
+  block->dictionary = p->window;
+  block->last = last;
+  block->done = false;
+  p->current = NULL;
+  p->current_size = 0;
+  p->total_in += block->input.size();
+
+  if (block->input.size() >= kWindowSize) {
+    p->window.assign(block->input, block->input.size() - kWindowSize,
+                     kWindowSize);
+  } else {
+    p->window.append(block->input);
+    if (p->window.size() > kWindowSize) {
+      p->window.erase(0, p->window.size() - kWindowSize);
+    }
+  }
+
+  p->pending.push_back(block);
+  p->Lock();
+  p->queue.push_back(block);
+#ifdef HAVE_PTHREAD
+  pthread_cond_signal(&p->block_queued);
+#endif
+  p->Unlock();
+}
+
+bool GzipOutputStream::WriteBlocks(int max_pending) {
+  Parallel* p = parallel_;
+  p->Lock();
+  while (true) {
+    while (!p->pending.empty() && p->pending.front()->done) {
+      Block* block = p->pending.front();
+      p->pending.pop_front();
+      p->Unlock();
+      if (block->error != Z_OK) {
+        zerror_ = block->error;
+        return false;
+      }
+      if (!p->header_written) {
+        uint8 header[10];
+        int header_size;
+        int level = p->compression_level;
+        if (level == Z_DEFAULT_COMPRESSION) {
+          level = 6;
+        }
+        if (p->format == GZIP) {
+          // No file name or time; the same header deflate() writes.
+          static const uint8 kGzipHeader[] = {0x1f, 0x8b, Z_DEFLATED, 0,
+                                              0, 0, 0, 0, 0, /* OS */3};
+          memcpy(header, kGzipHeader, sizeof(kGzipHeader));
+          header[8] = level == 9 ? 2 :
+              (p->compression_strategy >= Z_HUFFMAN_ONLY || level < 2) ?
+              4 : 0;
+          header_size = sizeof(kGzipHeader);
+        } else {
+          int level_flags =
+              (p->compression_strategy >= Z_HUFFMAN_ONLY || level < 2) ? 0 :
+              level < 6 ? 1 : level == 6 ? 2 : 3;
+          uint32 zlib_header = (0x78 << 8) | (level_flags << 6);
+          zlib_header += 31 - zlib_header % 31;
+          header[0] = zlib_header >> 8;
+          header[1] = zlib_header & 0xff;
+          header_size = 2;
+        }
+        if (!WriteToSubStream(header, header_size)) {
+          zerror_ = Z_BUF_ERROR;
+          return false;
+        }
+        p->header_written = true;
+      }
+      if (!WriteToSubStream(block->output.data(), block->output.size())) {
+        zerror_ = Z_BUF_ERROR;
+        return false;
+      }
+      uLong size = block->input.size();
+      if (p->format == GZIP) {
+        p->check = crc32_combine(p->check, block->check, size);
+      } else {
+        p->check = adler32_combine(p->check, block->check, size);
+      }
+      if (block->last) {
+        uint8 trailer[8];
+        int trailer_size;
+        if (p->format == GZIP) {
+          // CRC and input size, little-endian.
+          for (int i = 0; i < 4; i++) {
+            trailer[i] = (p->check >> (8 * i)) & 0xff;
+            trailer[4 + i] = (p->total_in >> (8 * i)) & 0xff;
+          }
+          trailer_size = 8;
+        } else {
+          // Adler-32, big-endian.
+          for (int i = 0; i < 4; i++) {
+            trailer[i] = (p->check >> (24 - 8 * i)) & 0xff;
+          }
+          trailer_size = 4;
+        }
+        if (!WriteToSubStream(trailer, trailer_size)) {
+          zerror_ = Z_BUF_ERROR;
+          return false;
+        }
+      }
+      p->free_blocks.push_back(block);
+      p->Lock();
+    }
+    if (p->pending.size() <= static_cast<size_t>(max_pending)) {
+      break;
+    }
+    if (!p->queue.empty()) {
+      // Rather than wait, compress a block here.
+      Block* block = p->queue.front();
+      p->queue.pop_front();
+      p->Unlock();
+      CompressBlock(&zcontext_, p->format, block);
+      p->Lock();
+      block->done = true;
+      continue;
+    }
+#ifdef HAVE_PTHREAD
+    pthread_cond_wait(&p->block_done, &p->mutex);
+#endif
+  }
+  p->Unlock();
+  return true;
+}
+
+bool GzipOutputStream::WriteToSubStream(const void* data, int size) {
+  const uint8* in = static_cast<const uint8*>(data);
+  while (size > 0) {
+    void* out;
+    int out_size;
+    if (!sub_stream_->Next(&out, &out_size)) {
+      return false;
+    }
+    int n = std::min(size, out_size);
+    memcpy(out, in, n);
+    in += n;
+    size -= n;
+    if (n < out_size) {
+      sub_stream_->BackUp(out_size - n);
+    }
+  }
+  return true;
+}
+
 // implements ZeroCopyOutputStream ---------------------------------
 bool GzipOutputStream::Next(void** data, int* size) {
+  if (parallel_ != NULL) {
+    if (zerror_ != Z_OK) {
+      return false;
+    }
+    Parallel* p = parallel_;
+    int block_size = input_buffer_length_;
+    if (p->current != NULL && p->current_size == block_size) {
+      SubmitBlock(false);
+      // Keep a few blocks per thread in flight.
+      if (!WriteBlocks(2 * p->num_threads)) {
+        return false;
+      }
+    }
+    if (p->current == NULL) {
+      if (p->free_blocks.empty()) {
+        p->blocks.push_back(new Block);
+        p->free_blocks.push_back(p->blocks.back());
+      }
+      p->current = p->free_blocks.back();
+      p->free_blocks.pop_back();
+      p->current->input.resize(block_size);
+      p->current_size = 0;
+    }
+    *data = &p->current->input[p->current_size];
+    *size = block_size - p->current_size;
+    p->current_size = block_size;
+    return true;
+  }
   if ((zerror_ != Z_OK) && (zerror_ != Z_BUF_ERROR)) {
     return false;
   }
@@ -297,14 +897,33 @@ bool GzipOutputStream::Next(void** data, int* size) {
   return true;
 }
 void GzipOutputStream::BackUp(int count) {
+  if (parallel_ != NULL) {
+    GOOGLE_CHECK_GE(parallel_->current_size, count);
+    parallel_->current_size -= count;
+    return;
+  }
   GOOGLE_CHECK_GE(zcontext_.avail_in, count);
   zcontext_.avail_in -= count;
 }
 int64 GzipOutputStream::ByteCount() const {
+  if (parallel_ != NULL) {
+    return parallel_->total_in + parallel_->current_size;
+  }
   return zcontext_.total_in + zcontext_.avail_in;
 }
 
 bool GzipOutputStream::Flush() {
+  if (parallel_ != NULL) {
+    if (zerror_ != Z_OK) {
+      return false;
+    }
+    // Every block ends on a byte boundary, so writing out all submitted
+    // blocks flushes.
+    if (parallel_->current_size > 0) {
+      SubmitBlock(false);
+    }
+    return WriteBlocks(0);
+  }
   zerror_ = Deflate(Z_FULL_FLUSH);
   // Return true if the flush succeeded or if it was a no-op.
   return  (zerror_ == Z_OK) ||
@@ -316,6 +935,18 @@ bool GzipOutputStream::Close() {
   if ((zerror_ != Z_OK) && (zerror_ != Z_BUF_ERROR)) {
     return false;
   }
+  if (parallel_ != NULL) {
+    bool ok = false;
+    if (zerror_ == Z_OK) {
+      SubmitBlock(true);
+      ok = WriteBlocks(0);
+    }
+    // zcontext_ may have stopped after any block, which deflateEnd()
+    // reports as an error.
+    deflateEnd(&zcontext_);
+    zerror_ = Z_STREAM_END;
+    return ok;
+  }
   do {
     zerror_ = Deflate(Z_FINISH);
   } while (zerror_ == Z_OK);
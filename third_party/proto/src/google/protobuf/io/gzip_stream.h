@@ -39,6 +39,10 @@
 //
 // GzipOutputStream is an ZeroCopyOutputStream that compresses data to
 // an underlying ZeroCopyOutputStream.
+//
+// Both can use more threads for large streams: GzipOutputStream can
+// compress independent blocks on a pool of threads, the way pigz does, and
+// GzipInputStream can inflate ahead of the caller on a background thread.
 
 #ifndef GOOGLE_PROTOBUF_IO_GZIP_STREAM_H__
 #define GOOGLE_PROTOBUF_IO_GZIP_STREAM_H__
@@ -68,18 +72,24 @@ class LIBPROTOBUF_EXPORT GzipInputStream : public ZeroCopyInputStream {
   };
 
   // buffer_size and format may be -1 for default of 64kB and GZIP format
+  //
+  // If read_ahead_buffers is positive, a background thread reads from
+  // sub_stream and inflates up to that many buffers of buffer_size bytes
+  // ahead of the caller.  sub_stream must then not be used by anyone else
+  // until this stream is destroyed.  Ignored without pthreads.
   explicit GzipInputStream(
       ZeroCopyInputStream* sub_stream,
       Format format = AUTO,
-      int buffer_size = -1);
+      int buffer_size = -1,
+      int read_ahead_buffers = 0);
   virtual ~GzipInputStream();
 
   // Return last error message or NULL if no error.
   inline const char* ZlibErrorMessage() const {
-    return zcontext_.msg;
+    return read_ahead_ == NULL ? zcontext_.msg : read_ahead_msg_;
   }
   inline int ZlibErrorCode() const {
-    return zerror_;
+    return read_ahead_ == NULL ? zerror_ : read_ahead_zerror_;
   }
 
   // implements ZeroCopyInputStream ----------------------------------
@@ -101,9 +111,25 @@ class LIBPROTOBUF_EXPORT GzipInputStream : public ZeroCopyInputStream {
   size_t output_buffer_length_;
   int64 byte_count_;
 
+  // State of the background thread if reading ahead, see gzip_stream.cc.
+  struct ReadAhead;
+  ReadAhead* read_ahead_;
+  // When reading ahead, zcontext_ and zerror_ belong to the background
+  // thread.  ReadAheadNext() copies its error state here with each chunk.
+  const char* read_ahead_msg_;
+  int read_ahead_zerror_;
+
   int Inflate(int flush);
   void DoNextOutput(const void** data, int* size);
 
+  // Next() without reading ahead.
+  bool InflateNext(const void** data, int* size);
+  // Next() when reading ahead.
+  bool ReadAheadNext(const void** data, int* size);
+  // The body of the background thread.
+  void ReadAheadLoop();
+  static void* ReadAheadThread(void* stream);
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(GzipInputStream);
 };
 
@@ -135,6 +161,15 @@ class LIBPROTOBUF_EXPORT GzipOutputStream : public ZeroCopyOutputStream {
     // zlib.h for definitions of these constants.
     int compression_strategy;
 
+    // Number of threads to compress with.  If greater than 1, every
+    // buffer_size bytes of input are compressed as an independent block,
+    // primed with the preceding 32kB, on a pool of num_threads - 1
+    // threads and the calling thread.  The result is still a single gzip
+    // or zlib stream, slightly larger than with one thread.  Without
+    // pthreads, the blocks are all compressed on the calling thread.
+    // Defaults to 1.
+    int num_threads;
+
     Options();  // Initializes with default values.
   };
 
@@ -192,6 +227,11 @@ class LIBPROTOBUF_EXPORT GzipOutputStream : public ZeroCopyOutputStream {
   void* input_buffer_;
   size_t input_buffer_length_;
 
+  // State of the block compressor if compressing with several threads, see
+  // gzip_stream.cc.
+  struct Parallel;
+  Parallel* parallel_;
+
   // Shared constructor code.
   void Init(ZeroCopyOutputStream* sub_stream, const Options& options);
 
@@ -200,6 +240,17 @@ class LIBPROTOBUF_EXPORT GzipOutputStream : public ZeroCopyOutputStream {
   // Returns zlib error code.
   int Deflate(int flush);
 
+  // Hands the current block, which may be empty, to the compressing
+  // threads.
+  void SubmitBlock(bool last);
+  // Writes out compressed blocks, in order, until at most max_pending
+  // blocks are still being compressed.  The calling thread helps to
+  // compress while it waits.  Sets zerror_ and returns false on error.
+  bool WriteBlocks(int max_pending);
+  // Writes data to sub_stream_.
+  bool WriteToSubStream(const void* data, int size);
+  static void* CompressThread(void* parallel);
+
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(GzipOutputStream);
 };
 
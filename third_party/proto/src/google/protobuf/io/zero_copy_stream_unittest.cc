@@ -68,6 +68,7 @@
 #endif
 
 #include <google/protobuf/stubs/common.h>
+#include <google/protobuf/stubs/strutil.h>
 #include <google/protobuf/testing/googletest.h>
 #include <google/protobuf/testing/file.h>
 #include <gtest/gtest.h>
@@ -531,6 +532,181 @@ TEST_F(IoTest, ZlibIoInputAutodetect) {
   delete [] buffer;
 }
 
+TEST_F(IoTest, GzipIoParallel) {
+  const int kBufferSize = 4*1024;
+  const GzipOutputStream::Format kFormats[] = {
+    GzipOutputStream::GZIP, GzipOutputStream::ZLIB
+  };
+  const int kThreadCounts[] = {2, 4};
+  uint8* buffer = new uint8[kBufferSize];
+  for (int f = 0; f < GOOGLE_ARRAYSIZE(kFormats); f++) {
+    for (int t = 0; t < GOOGLE_ARRAYSIZE(kThreadCounts); t++) {
+      for (int i = 0; i < kBlockSizeCount; i++) {
+        for (int z = 0; z < kBlockSizeCount; z++) {
+          int gzip_buffer_size = kBlockSizes[z];
+          int size;
+          {
+            ArrayOutputStream output(buffer, kBufferSize, kBlockSizes[i]);
+            GzipOutputStream::Options options;
+            options.format = kFormats[f];
+            options.num_threads = kThreadCounts[t];
+            if (gzip_buffer_size != -1) {
+              options.buffer_size = gzip_buffer_size;
+            }
+            GzipOutputStream gzout(&output, options);
+            WriteStuff(&gzout);
+            EXPECT_TRUE(gzout.Close());
+            size = output.ByteCount();
+          }
+          {
+            ArrayInputStream input(buffer, size, kBlockSizes[i]);
+            GzipInputStream gzin(&input, GzipInputStream::AUTO);
+            ReadStuff(&gzin);
+            EXPECT_EQ(Z_STREAM_END, gzin.ZlibErrorCode());
+          }
+        }
+      }
+    }
+  }
+  delete [] buffer;
+}
+
+TEST_F(IoTest, GzipIoParallelWithFlush) {
+  // Everything written before a Flush() can be read right away.
+  string compressed;
+  StringOutputStream output(&compressed);
+  GzipOutputStream::Options options;
+  options.num_threads = 4;
+  options.buffer_size = 16;
+  GzipOutputStream gzout(&output, options);
+  WriteStuff(&gzout);
+  EXPECT_TRUE(gzout.Flush());
+  EXPECT_TRUE(gzout.Flush());
+
+  {
+    ArrayInputStream input(compressed.data(), compressed.size());
+    GzipInputStream gzin(&input, GzipInputStream::GZIP);
+    ReadStuff(&gzin);
+  }
+
+  WriteString(&gzout, "more");
+  EXPECT_TRUE(gzout.Close());
+  EXPECT_EQ("Hello world!\nSome text.  Blah blah.abcdefg"
+            "01234567890123456789foobarmore", Uncompress(compressed));
+}
+
+TEST_F(IoTest, GzipIoParallelLarge) {
+  for (int threads = 1; threads <= 4; threads++) {
+    string compressed;
+    {
+      StringOutputStream output(&compressed);
+      GzipOutputStream::Options options;
+      options.num_threads = threads;
+      options.buffer_size = 4096;
+      GzipOutputStream gzout(&output, options);
+      WriteStuffLarge(&gzout);
+      EXPECT_TRUE(gzout.Close());
+      EXPECT_EQ(200055, gzout.ByteCount());
+    }
+    ArrayInputStream input(compressed.data(), compressed.size(), 1000);
+    GzipInputStream gzin(&input, GzipInputStream::GZIP, 4096);
+    ReadStuffLarge(&gzin);
+    EXPECT_EQ(Z_STREAM_END, gzin.ZlibErrorCode());
+  }
+}
+
+TEST_F(IoTest, GzipIoReadAhead) {
+  const int kBufferSize = 2*1024;
+  const int kReadAheadBuffers[] = {1, 3};
+  uint8* buffer = new uint8[kBufferSize];
+  for (int r = 0; r < GOOGLE_ARRAYSIZE(kReadAheadBuffers); r++) {
+    for (int j = 0; j < kBlockSizeCount; j++) {
+      for (int z = 0; z < kBlockSizeCount; z++) {
+        int gzip_buffer_size = kBlockSizes[z];
+        int size;
+        {
+          ArrayOutputStream output(buffer, kBufferSize);
+          GzipOutputStream gzout(&output);
+          WriteStuff(&gzout);
+          gzout.Close();
+          size = output.ByteCount();
+        }
+        {
+          ArrayInputStream input(buffer, size, kBlockSizes[j]);
+          GzipInputStream gzin(&input, GzipInputStream::GZIP,
+                               gzip_buffer_size, kReadAheadBuffers[r]);
+          ReadStuff(&gzin);
+          EXPECT_EQ(Z_STREAM_END, gzin.ZlibErrorCode());
+        }
+      }
+    }
+  }
+  delete [] buffer;
+}
+
+TEST_F(IoTest, GzipIoReadAheadLarge) {
+  string compressed;
+  {
+    StringOutputStream output(&compressed);
+    GzipOutputStream gzout(&output);
+    WriteStuffLarge(&gzout);
+  }
+  ArrayInputStream input(compressed.data(), compressed.size(), 1000);
+  GzipInputStream gzin(&input, GzipInputStream::GZIP, 4096, 2);
+  ReadStuffLarge(&gzin);
+}
+
+TEST_F(IoTest, GzipIoReadAheadError) {
+  string compressed;
+  {
+    StringOutputStream output(&compressed);
+    GzipOutputStream gzout(&output);
+    WriteStuffLarge(&gzout);
+  }
+  compressed[compressed.size() / 2] ^= 0x55;
+  ArrayInputStream input(compressed.data(), compressed.size());
+  GzipInputStream gzin(&input, GzipInputStream::GZIP, 4096, 2);
+  const void* data;
+  int size;
+  while (gzin.Next(&data, &size)) {}
+  EXPECT_FALSE(gzin.Next(&data, &size));
+  EXPECT_NE(Z_OK, gzin.ZlibErrorCode());
+  EXPECT_NE(Z_STREAM_END, gzin.ZlibErrorCode());
+  EXPECT_TRUE(gzin.ZlibErrorMessage() != NULL);
+}
+
+// Round-trips a megabyte of text through the parallel and read-ahead modes.
+// benchmarks/gzip_bench.cc compares their throughput.
+TEST_F(IoTest, GzipParallelText) {
+  const int kDataSize = 1 << 20;
+  string data;
+  uint32 seed = 1;
+  while (static_cast<int>(data.size()) < kDataSize) {
+    seed = seed * 1103515245 + 12345;
+    data += SimpleItoa(seed >> 16 & 0xfff);
+    data += (seed >> 8) & 1 ? ' ' : '\n';
+  }
+
+  GzipOutputStream::Options options;
+  string serial = Compress(data, options);
+  options.num_threads = 4;
+  string parallel = Compress(data, options);
+  EXPECT_TRUE(Uncompress(parallel) == data);
+  // Priming each block with the preceding data keeps the loss small.
+  EXPECT_LT(parallel.size(), serial.size() * 1.05);
+
+  string uncompressed;
+  ArrayInputStream input(serial.data(), serial.size());
+  GzipInputStream gzin(&input, GzipInputStream::GZIP, -1, 4);
+  const void* buffer;
+  int size;
+  while (gzin.Next(&buffer, &size)) {
+    uncompressed.append(reinterpret_cast<const char*>(buffer), size);
+  }
+  EXPECT_EQ(Z_STREAM_END, gzin.ZlibErrorCode());
+  EXPECT_TRUE(uncompressed == data);
+}
+
 string IoTest::Compress(const string& data,
                         const GzipOutputStream::Options& options) {
   string result;
@@ -540,6 +540,26 @@ class LIBPROTOBUF_EXPORT WireFormatLite {
       google::protobuf::io::CodedInputStream* input,
       RepeatedField<CType>* value) GOOGLE_ATTRIBUTE_ALWAYS_INLINE;
 
+  // Like ReadPackedFixedSizePrimitive but for the varint types.  Decodes as
+  // many values as possible straight from the current buffer and only falls
+  // back to ReadPrimitive() near the end of the buffer.
+  template <typename CType, enum FieldType DeclaredType>
+  static inline bool ReadPackedVarintPrimitive(
+      google::protobuf::io::CodedInputStream* input,
+      RepeatedField<CType>* value) GOOGLE_ATTRIBUTE_ALWAYS_INLINE;
+
+  // Converts a decoded varint to the value ReadPrimitive() would produce.
+  template <typename CType, enum FieldType DeclaredType>
+  static inline CType VarintToPrimitive(uint64 value);
+
+  // Decodes a varint from a buffer which has at least kMaxVarintBytes
+  // readable bytes.  Returns a pointer past the varint, or NULL if it is
+  // longer than kMaxVarintBytes.
+  static inline const uint8* ReadVarintFromArrayUnchecked(
+      const uint8* buffer, uint64* value) GOOGLE_ATTRIBUTE_ALWAYS_INLINE;
+
+  static const int kMaxVarintBytes = 10;
+
   static const CppType kFieldTypeToCppTypeMap[];
   static const WireFormatLite::WireType kWireTypeForFieldType[];
 
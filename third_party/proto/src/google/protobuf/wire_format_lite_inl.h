@@ -41,6 +41,7 @@
 #include <algorithm>
 #endif
 
+#include <string.h>
 #include <string>
 #include <google/protobuf/stubs/common.h>
 #include <google/protobuf/message_lite.h>
@@ -420,6 +421,169 @@ READ_REPEATED_PACKED_FIXED_SIZE_PRIMITIVE(double, TYPE_DOUBLE);
 
 #undef READ_REPEATED_PACKED_FIXED_SIZE_PRIMITIVE
 
+template <>
+inline int32
+WireFormatLite::VarintToPrimitive<int32, WireFormatLite::TYPE_INT32>(
+    uint64 value) {
+  return static_cast<int32>(static_cast<uint32>(value));
+}
+template <>
+inline int64
+WireFormatLite::VarintToPrimitive<int64, WireFormatLite::TYPE_INT64>(
+    uint64 value) {
+  return static_cast<int64>(value);
+}
+template <>
+inline uint32
+WireFormatLite::VarintToPrimitive<uint32, WireFormatLite::TYPE_UINT32>(
+    uint64 value) {
+  return static_cast<uint32>(value);
+}
+template <>
+inline uint64
+WireFormatLite::VarintToPrimitive<uint64, WireFormatLite::TYPE_UINT64>(
+    uint64 value) {
+  return value;
+}
+template <>
+inline int32
+WireFormatLite::VarintToPrimitive<int32, WireFormatLite::TYPE_SINT32>(
+    uint64 value) {
+  return ZigZagDecode32(static_cast<uint32>(value));
+}
+template <>
+inline int64
+WireFormatLite::VarintToPrimitive<int64, WireFormatLite::TYPE_SINT64>(
+    uint64 value) {
+  return ZigZagDecode64(value);
+}
+template <>
+inline bool
+WireFormatLite::VarintToPrimitive<bool, WireFormatLite::TYPE_BOOL>(
+    uint64 value) {
+  return value != 0;
+}
+template <>
+inline int
+WireFormatLite::VarintToPrimitive<int, WireFormatLite::TYPE_ENUM>(
+    uint64 value) {
+  return static_cast<int>(static_cast<uint32>(value));
+}
+
+inline const uint8* WireFormatLite::ReadVarintFromArrayUnchecked(
+    const uint8* buffer, uint64* value) {
+  // Values below 128 are by far the most common, so check for them first.
+  if (GOOGLE_PREDICT_TRUE(*buffer < 0x80)) {
+    *value = *buffer;
+    return buffer + 1;
+  }
+  uint64 result = 0;
+  int shift = 0;
+  const uint8* ptr = buffer;
+#if defined(PROTOBUF_LITTLE_ENDIAN) && defined(__GNUC__)
+  // Decode up to eight bytes at once: the lowest clear high bit ends the
+  // varint, everything above it is masked off and the 7-bit groups are
+  // squeezed together with three shift-and-merge steps.
+  uint64 word;
+  memcpy(&word, ptr, sizeof(word));
+  const uint64 stop_bits = ~word & GOOGLE_ULONGLONG(0x8080808080808080);
+  if (GOOGLE_PREDICT_TRUE(stop_bits != 0)) {
+    const int stop_bit = __builtin_ctzll(stop_bits);
+    word &= stop_bits ^ (stop_bits - 1);
+    word &= GOOGLE_ULONGLONG(0x7f7f7f7f7f7f7f7f);
+    word = ((word & GOOGLE_ULONGLONG(0x7f007f007f007f00)) >> 1) |
+           (word & GOOGLE_ULONGLONG(0x007f007f007f007f));
+    word = ((word & GOOGLE_ULONGLONG(0x3fff00003fff0000)) >> 2) |
+           (word & GOOGLE_ULONGLONG(0x00003fff00003fff));
+    word = ((word & GOOGLE_ULONGLONG(0x0fffffff00000000)) >> 4) |
+           (word & GOOGLE_ULONGLONG(0x000000000fffffff));
+    *value = word;
+    return ptr + (stop_bit >> 3) + 1;
+  }
+  // Nine or ten bytes; only negative numbers and values of 2^56 and up
+  // get here.
+  for (int i = 0; i < 8; ++i) {
+    result |= static_cast<uint64>(ptr[i] & 0x7F) << (7 * i);
+  }
+  ptr += 8;
+  shift = 56;
+#endif
+  for (; shift < 7 * kMaxVarintBytes; shift += 7) {
+    const uint32 b = *(ptr++);
+    result |= static_cast<uint64>(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *value = result;
+      return ptr;
+    }
+  }
+  // Longer than kMaxVarintBytes.  Assume the data is corrupt.
+  return NULL;
+}
+
+template <typename CType, enum WireFormatLite::FieldType DeclaredType>
+inline bool WireFormatLite::ReadPackedVarintPrimitive(
+    io::CodedInputStream* input, RepeatedField<CType>* values) {
+  // Upper bound for the number of values decoded, and so the number of
+  // elements reserved, between two checks of the buffer.
+  static const int kBatchSize = 1024;
+
+  uint32 length;
+  if (!input->ReadVarint32(&length)) return false;
+  io::CodedInputStream::Limit limit = input->PushLimit(length);
+  while (input->BytesUntilLimit() > 0) {
+    const void* void_pointer;
+    int size;
+    // The buffer ends at the limit, so the bulk path never reads past it.
+    input->GetDirectBufferPointerInline(&void_pointer, &size);
+    if (size > kMaxVarintBytes) {
+      // Every varint starting before batch_end lies completely in the
+      // buffer, and there can be at most one per byte.
+      const int batch_size = std::min(size - kMaxVarintBytes, kBatchSize);
+      const uint8* buffer = reinterpret_cast<const uint8*>(void_pointer);
+      const uint8* batch_end = buffer + batch_size;
+      values->Reserve(values->size() + batch_size);
+      while (buffer < batch_end) {
+        uint64 temp;
+        buffer = ReadVarintFromArrayUnchecked(buffer, &temp);
+        if (buffer == NULL) return false;
+        values->AddAlreadyReserved(
+            VarintToPrimitive<CType, DeclaredType>(temp));
+      }
+      input->Skip(buffer - reinterpret_cast<const uint8*>(void_pointer));
+    } else {
+      // Near the end of the buffer; let the stream refill it as needed.
+      CType value;
+      if (!ReadPrimitive<CType, DeclaredType>(input, &value)) return false;
+      values->Add(value);
+    }
+  }
+  input->PopLimit(limit);
+  return true;
+}
+
+// Specializations of ReadPackedPrimitive for the varint types, which decode
+// many values at once from the stream's buffer.
+#define READ_REPEATED_PACKED_VARINT_PRIMITIVE(CPPTYPE, DECLARED_TYPE)          \
+template <>                                                                    \
+inline bool WireFormatLite::ReadPackedPrimitive<                               \
+  CPPTYPE, WireFormatLite::DECLARED_TYPE>(                                     \
+    io::CodedInputStream* input,                                               \
+    RepeatedField<CPPTYPE>* values) {                                          \
+  return ReadPackedVarintPrimitive<                                            \
+      CPPTYPE, WireFormatLite::DECLARED_TYPE>(input, values);                  \
+}
+
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(int32, TYPE_INT32);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(int64, TYPE_INT64);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(uint32, TYPE_UINT32);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(uint64, TYPE_UINT64);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(int32, TYPE_SINT32);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(int64, TYPE_SINT64);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(bool, TYPE_BOOL);
+READ_REPEATED_PACKED_VARINT_PRIMITIVE(int, TYPE_ENUM);
+
+#undef READ_REPEATED_PACKED_VARINT_PRIMITIVE
+
 template <typename CType, enum WireFormatLite::FieldType DeclaredType>
 bool WireFormatLite::ReadPackedPrimitiveNoInline(io::CodedInputStream* input,
                                                  RepeatedField<CType>* values) {
@@ -767,6 +767,139 @@ TEST(WireFormatTest, RepeatedScalarsDifferentTagSizes) {
   EXPECT_EQ(msg1.DebugString(), msg2.DebugString());
 }
 
+// Encodes the given varints as the contents of a packed field, including
+// the length prefix.
+string EncodePackedVarints(const vector<uint64>& varints) {
+  string payload;
+  {
+    io::StringOutputStream raw_output(&payload);
+    io::CodedOutputStream output(&raw_output);
+    for (int i = 0; i < varints.size(); i++) {
+      output.WriteVarint64(varints[i]);
+    }
+  }
+  string data;
+  {
+    io::StringOutputStream raw_output(&data);
+    io::CodedOutputStream output(&raw_output);
+    output.WriteVarint32(payload.size());
+    output.WriteString(payload);
+  }
+  return data;
+}
+
+// Parses a packed field from data handed out block_size bytes at a time,
+// or all at once if block_size is -1.
+template <typename CType, WireFormatLite::FieldType DeclaredType>
+bool ReadPackedVarints(const string& data, int block_size,
+                       RepeatedField<CType>* values) {
+  io::ArrayInputStream raw_input(data.data(), data.size(), block_size);
+  io::CodedInputStream input(&raw_input);
+  return WireFormatLite::ReadPackedPrimitive<CType, DeclaredType>(
+             &input, values) &&
+         input.CurrentPosition() == data.size();
+}
+
+// Varints of every length from one to ten bytes.
+vector<uint64> MixedVarints() {
+  vector<uint64> varints;
+  for (int i = 0; i < 1000; i++) {
+    varints.push_back(i % 3 == 0 ? i % 100
+                                 : (GOOGLE_ULONGLONG(1) << (i % 64)) + i);
+    varints.push_back(static_cast<uint64>(static_cast<int64>(-i)));
+  }
+  return varints;
+}
+
+// Block sizes for the stream, so that varints straddle buffer boundaries.
+const int kBlockSizes[] = {-1, 1, 2, 3, 7, 10, 11, 13, 64};
+
+TEST(WireFormatTest, ReadPackedVarints) {
+  vector<uint64> varints = MixedVarints();
+  string data = EncodePackedVarints(varints);
+
+  for (int i = 0; i < GOOGLE_ARRAYSIZE(kBlockSizes); i++) {
+    SCOPED_TRACE(kBlockSizes[i]);
+    RepeatedField<uint64> values;
+    ASSERT_TRUE((ReadPackedVarints<uint64, WireFormatLite::TYPE_UINT64>(
+        data, kBlockSizes[i], &values)));
+    ASSERT_EQ(varints.size(), values.size());
+    for (int j = 0; j < varints.size(); j++) {
+      EXPECT_EQ(varints[j], values.Get(j));
+    }
+  }
+}
+
+TEST(WireFormatTest, ReadPackedVarintsConvertsTypes) {
+  vector<uint64> varints = MixedVarints();
+  string data = EncodePackedVarints(varints);
+
+  for (int i = 0; i < GOOGLE_ARRAYSIZE(kBlockSizes); i++) {
+    SCOPED_TRACE(kBlockSizes[i]);
+    RepeatedField<int32> int32_values;
+    RepeatedField<int32> sint32_values;
+    RepeatedField<int64> sint64_values;
+    RepeatedField<bool> bool_values;
+    ASSERT_TRUE((ReadPackedVarints<int32, WireFormatLite::TYPE_INT32>(
+        data, kBlockSizes[i], &int32_values)));
+    ASSERT_TRUE((ReadPackedVarints<int32, WireFormatLite::TYPE_SINT32>(
+        data, kBlockSizes[i], &sint32_values)));
+    ASSERT_TRUE((ReadPackedVarints<int64, WireFormatLite::TYPE_SINT64>(
+        data, kBlockSizes[i], &sint64_values)));
+    ASSERT_TRUE((ReadPackedVarints<bool, WireFormatLite::TYPE_BOOL>(
+        data, kBlockSizes[i], &bool_values)));
+    ASSERT_EQ(varints.size(), int32_values.size());
+    ASSERT_EQ(varints.size(), sint32_values.size());
+    ASSERT_EQ(varints.size(), sint64_values.size());
+    ASSERT_EQ(varints.size(), bool_values.size());
+    for (int j = 0; j < varints.size(); j++) {
+      EXPECT_EQ(static_cast<int32>(varints[j]), int32_values.Get(j));
+      EXPECT_EQ(WireFormatLite::ZigZagDecode32(static_cast<uint32>(varints[j])),
+                sint32_values.Get(j));
+      EXPECT_EQ(WireFormatLite::ZigZagDecode64(varints[j]),
+                sint64_values.Get(j));
+      EXPECT_EQ(varints[j] != 0, bool_values.Get(j));
+    }
+  }
+}
+
+TEST(WireFormatTest, ReadPackedVarintsRejectsLongVarint) {
+  // Eleven bytes with the continuation bit set on all but the last, between
+  // valid values and followed by enough bytes that the whole thing can be
+  // decoded straight from the buffer.
+  string payload = "\x01\x02";
+  payload.append(10, '\xff');
+  payload.append(1, '\x01');
+  payload.append(20, '\x03');
+  string data;
+  data.push_back(static_cast<char>(payload.size()));
+  data += payload;
+
+  for (int i = 0; i < GOOGLE_ARRAYSIZE(kBlockSizes); i++) {
+    SCOPED_TRACE(kBlockSizes[i]);
+    RepeatedField<uint64> values;
+    EXPECT_FALSE((ReadPackedVarints<uint64, WireFormatLite::TYPE_UINT64>(
+        data, kBlockSizes[i], &values)));
+  }
+}
+
+TEST(WireFormatTest, ReadPackedVarintsRejectsTruncatedVarint) {
+  // The last varint runs past the end of the field.
+  string payload(30, '\x01');
+  payload.append(3, '\xff');
+  string data;
+  data.push_back(static_cast<char>(payload.size()));
+  data += payload;
+  data.append(20, '\x01');
+
+  for (int i = 0; i < GOOGLE_ARRAYSIZE(kBlockSizes); i++) {
+    SCOPED_TRACE(kBlockSizes[i]);
+    RepeatedField<int32> values;
+    EXPECT_FALSE((ReadPackedVarints<int32, WireFormatLite::TYPE_INT32>(
+        data, kBlockSizes[i], &values)));
+  }
+}
+
 TEST(WireFormatTest, CompatibleTypes) {
   const int64 data = 0x100000000;
   unittest::Int64Message msg1;